@@ -0,0 +1,85 @@
+// Free 100k suballocations of `DeviceAllocator` in random order, the teardown of a large scene.
+//
+// Usage: `deviceallocatorbench [count]`. Needs a device, hence a window to find one which can present.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "frontend/glfw3.h"
+#include "frontend/window.h"
+#include "vulkan/instance.h"
+#include "vulkan/logicaldevice.h"
+#include "vulkan/physicaldevice.h"
+#include "vulkan/surfacekhr.h"
+#include "vulkan_engine.h"
+
+using namespace Engine;
+
+int main(int argc, char **argv)
+{
+    usize const count = argc > 1 ? std::stoul(argv[1]) : 100'000;
+
+    if (!Frontend::init() || !Frontend::isVulkanSupported())
+    {
+        throw std::runtime_error("Vulkan not found/supported by windowing system.");
+    }
+
+    Frontend::Window window(320, 240, "Device allocator benchmark");
+    auto requiredExtensions = Frontend::getRequiredInstanceExtensions();
+    auto instance = Vulkan::Instance::create({}, requiredExtensions);
+    auto surface = Vulkan::SurfaceKHR::create(&instance, &window);
+
+    auto physicalDevice = Vulkan::PhysicalDevice::findBest(&instance, &surface);
+    if (!physicalDevice.has_value())
+    {
+        throw std::runtime_error("Could not find any suitable GPU.");
+    }
+
+    auto device = Vulkan::LogicalDevice::create(std::move(*physicalDevice));
+    auto &allocator = device.allocator();
+
+    // Sizes of buffers and small images: 256B to 1MB.
+    std::mt19937_64 random(42);
+    std::uniform_real_distribution<double> sizeLog2(8., 20.);
+
+    std::vector<Vulkan::DeviceAllocator::ResourceMemory> resources;
+    resources.reserve(count);
+
+    auto const allocationStart = std::chrono::steady_clock::now();
+    for (usize i = 0; i < count; i++)
+    {
+        VkMemoryRequirements const requirements
+        {
+            .size = static_cast<VkDeviceSize>(std::exp2(sizeLog2(random))),
+            .alignment = 256,
+            .memoryTypeBits = ~0u,
+        };
+        resources.push_back(allocator.allocate(requirements, Vulkan::DeviceAllocator::MemoryUsage::GpuOnly,
+                                               Vulkan::DeviceAllocator::Tiling::Linear));
+    }
+    double const allocationSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - allocationStart).count();
+
+    std::shuffle(resources.begin(), resources.end(), random);
+
+    // Trimming gives the ranges kept by the thread cache back, which is part of the teardown.
+    auto const freeStart = std::chrono::steady_clock::now();
+    for (auto const &resource : resources)
+    {
+        allocator.free(resource);
+    }
+    allocator.trim();
+    double const freeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - freeStart).count();
+
+    spdlog::info("Allocated {} suballocations in {:.3f}s ({:.0f}ns each).", count, allocationSeconds,
+                 allocationSeconds * 1e9 / static_cast<double>(count));
+    spdlog::info("Freed them in random order in {:.3f}s ({:.0f}ns each, {:.0f} frees/s).", freeSeconds,
+                 freeSeconds * 1e9 / static_cast<double>(count), static_cast<double>(count) / freeSeconds);
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+// Allocate and free from several threads at once, checking the live ranges handed out by `DeviceAllocator` never
+// overlap. Covers the per-thread caches, drained concurrently by `trim()`.
+//
+// Usage: `deviceallocatorstress [threads] [operations per thread]`. Needs a device, hence a window to find one which
+// can present. Exits with 1 if two live ranges overlapped or a range was misaligned.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <random>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "frontend/glfw3.h"
+#include "frontend/window.h"
+#include "vulkan/instance.h"
+#include "vulkan/logicaldevice.h"
+#include "vulkan/physicaldevice.h"
+#include "vulkan/surfacekhr.h"
+#include "vulkan_engine.h"
+
+using namespace Engine;
+
+namespace
+{
+/**
+ * Every range currently handed out, across threads.
+ */
+class LiveRanges
+{
+public:
+    /**
+     * @return `false` if `resource` overlaps a live range.
+     */
+    bool insert(Vulkan::DeviceAllocator::ResourceMemory const &resource)
+    {
+        std::lock_guard lock(_mutex);
+
+        // map<offset, end>
+        auto &ranges = _ranges[resource.memory];
+        VkDeviceSize const end = resource.offset + resource.size;
+
+        auto next = ranges.lower_bound(resource.offset);
+        bool const overlapsNext = next != ranges.end() && next->first < end;
+        bool const overlapsPrevious = next != ranges.begin() && std::prev(next)->second > resource.offset;
+        if (overlapsNext || overlapsPrevious)
+        {
+            return false;
+        }
+
+        ranges.insert(next, {resource.offset, end});
+        return true;
+    }
+
+    // Before freeing: once freed, another thread may be handed the same range.
+    void erase(Vulkan::DeviceAllocator::ResourceMemory const &resource)
+    {
+        std::lock_guard lock(_mutex);
+
+        _ranges[resource.memory].erase(resource.offset);
+    }
+
+private:
+    std::mutex _mutex;
+    std::unordered_map<VkDeviceMemory, std::map<VkDeviceSize, VkDeviceSize>> _ranges;
+};
+}
+
+int main(int argc, char **argv)
+{
+    usize const threadCount = argc > 1 ? std::stoul(argv[1]) : std::max(std::thread::hardware_concurrency(), 4u);
+    usize const operationCount = argc > 2 ? std::stoul(argv[2]) : 200'000;
+
+    if (!Frontend::init() || !Frontend::isVulkanSupported())
+    {
+        throw std::runtime_error("Vulkan not found/supported by windowing system.");
+    }
+
+    Frontend::Window window(320, 240, "Device allocator stress test");
+    auto requiredExtensions = Frontend::getRequiredInstanceExtensions();
+    auto instance = Vulkan::Instance::create({}, requiredExtensions);
+    auto surface = Vulkan::SurfaceKHR::create(&instance, &window);
+
+    auto physicalDevice = Vulkan::PhysicalDevice::findBest(&instance, &surface);
+    if (!physicalDevice.has_value())
+    {
+        throw std::runtime_error("Could not find any suitable GPU.");
+    }
+
+    auto device = Vulkan::LogicalDevice::create(std::move(*physicalDevice));
+    auto &allocator = device.allocator();
+
+    LiveRanges liveRanges;
+    std::atomic<usize> overlapCount = 0;
+    std::atomic<bool> done = false;
+
+    auto const work = [&](uint64 seed)
+    {
+        std::mt19937_64 random(seed);
+        // Mostly sizes served by the thread caches, some bigger ones: 256B to 256KB.
+        std::uniform_real_distribution<double> sizeLog2(8., 18.);
+
+        std::vector<Vulkan::DeviceAllocator::ResourceMemory> resources;
+
+        for (usize i = 0; i < operationCount; i++)
+        {
+            // Grow to a few thousand live resources, then churn around that.
+            if (resources.empty() || (resources.size() < 4000 && random() % 2 == 0))
+            {
+                VkMemoryRequirements const requirements
+                {
+                    .size = static_cast<VkDeviceSize>(std::exp2(sizeLog2(random))),
+                    .alignment = VkDeviceSize(1) << (random() % 9),
+                    .memoryTypeBits = ~0u,
+                };
+                auto const usage = random() % 2 == 0 ? Vulkan::DeviceAllocator::MemoryUsage::GpuOnly
+                                                     : Vulkan::DeviceAllocator::MemoryUsage::Upload;
+                auto const resource = allocator.allocate(requirements, usage, Vulkan::DeviceAllocator::Tiling::Linear);
+
+                if (resource.offset % requirements.alignment != 0 || !liveRanges.insert(resource))
+                {
+                    spdlog::error("Range [{}, {}) is misaligned or already in use.", resource.offset, resource.offset + resource.size);
+                    ++overlapCount;
+                    continue;
+                }
+
+                resources.push_back(resource);
+            }
+            else
+            {
+                usize const index = random() % resources.size();
+                liveRanges.erase(resources[index]);
+                allocator.free(resources[index]);
+                resources[index] = resources.back();
+                resources.pop_back();
+            }
+        }
+
+        for (auto const &resource : resources)
+        {
+            liveRanges.erase(resource);
+            allocator.free(resource);
+        }
+    };
+
+    auto const start = std::chrono::steady_clock::now();
+
+    // Drains the thread caches while the others fill them.
+    std::thread trimmer([&]()
+    {
+        while (!done)
+        {
+            allocator.trim();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (usize i = 0; i < threadCount; i++)
+    {
+        threads.emplace_back(work, 42 + i);
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    done = true;
+    trimmer.join();
+    allocator.trim();
+
+    double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    spdlog::info("{} threads ran {} operations each in {:.3f}s, {} overlapping ranges.", threadCount, operationCount,
+                 seconds, overlapCount.load());
+
+    return overlapCount == 0 ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+// Compare the mip chain the device blits for a texture with the one `MipChain` generates on the CPU. Filters of blits
+// are loosely defined by the specification, so both are expected to differ by rounding only.
+//
+// Usage: `mipchaincheck [texture]`, an 8 bits per channel file stb_image reads. Needs a device, hence a window to find
+// one which can present. Exits with 1 if a level differs by more than rounding.
+
+#include <algorithm>
+#include <chrono>
+#include <spdlog/spdlog.h>
+#include <stb_image.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "frontend/glfw3.h"
+#include "frontend/window.h"
+#include "vulkan/buffer.h"
+#include "vulkan/commandbuffer.h"
+#include "vulkan/commandpool.h"
+#include "vulkan/image.h"
+#include "vulkan/instance.h"
+#include "vulkan/logicaldevice.h"
+#include "vulkan/mipchain.h"
+#include "vulkan/physicaldevice.h"
+#include "vulkan/surfacekhr.h"
+#include "vulkan/texturedata.h"
+#include "vulkan/uploadservice.h"
+#include "vulkan_engine.h"
+
+using namespace Engine;
+
+int main(int argc, char **argv)
+{
+    std::string const path = argc > 1 ? argv[1] : "resources/textures/viking_room.png";
+    constexpr VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+
+    if (!Frontend::init() || !Frontend::isVulkanSupported())
+    {
+        throw std::runtime_error("Vulkan not found/supported by windowing system.");
+    }
+
+    Frontend::Window window(320, 240, "Mip chain check");
+    auto requiredExtensions = Frontend::getRequiredInstanceExtensions();
+    auto instance = Vulkan::Instance::create({}, requiredExtensions);
+    auto surface = Vulkan::SurfaceKHR::create(&instance, &window);
+
+    auto physicalDevice = Vulkan::PhysicalDevice::findBest(&instance, &surface);
+    if (!physicalDevice.has_value())
+    {
+        throw std::runtime_error("Could not find any suitable GPU.");
+    }
+
+    auto device = Vulkan::LogicalDevice::create(std::move(*physicalDevice));
+    auto commandPool = Vulkan::CommandPool::create(&device);
+    auto uploads = Vulkan::UploadService::create(&device);
+
+    auto data = Vulkan::TextureData::createFromFile(&device, path, format, VK_IMAGE_TILING_OPTIMAL);
+
+    // Without blits, the levels are generated by `MipChain` itself: there is nothing to compare.
+    if (data.mipLevels() == 1 || data.regions().size() != 1)
+    {
+        spdlog::info("The device doesn't blit the mip chain of '{}', nothing to check.", path);
+        return 0;
+    }
+
+    int width {};
+    int height {};
+    int channels {};
+    stbi_uc *pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels)
+    {
+        throw std::runtime_error("can not open texture " + path);
+    }
+
+    VkExtent2D const size {.width = static_cast<uint32>(width), .height = static_cast<uint32>(height)};
+    auto const reference = Vulkan::MipChain::generate(std::as_bytes(std::span(pixels, usize {size.width} * size.height * 4)), size, true);
+    stbi_image_free(pixels);
+
+    // Read back once blitted, hence the transfer source usage.
+    auto image = Vulkan::Image::createFromData(std::move(data), &device, uploads,
+                                               VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+    auto const uploaded = uploads.submit();
+
+    auto readback = Vulkan::Buffer::create(&device, VK_BUFFER_USAGE_TRANSFER_DST_BIT, reference.data().size(),
+                                           Vulkan::DeviceAllocator::MemoryUsage::Readback);
+
+    auto commandBuffer = Vulkan::CommandBuffer::create(&device, &commandPool);
+    commandBuffer.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+    // The acquisition of the upload records the blits of the mip chain.
+    while (!uploads.isComplete(uploaded))
+    {
+        uploads.cmdAcquire(commandBuffer);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    image.copyToBuffer(commandBuffer, readback, reference.regions());
+
+    VkMemoryBarrier const toHost
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &toHost, 0, nullptr, 0, nullptr);
+
+    commandBuffer.end();
+    commandBuffer.submit(true);
+    readback.invalidate();
+
+    // Rounding, and averaging sRGB values in linear space or not, is up to the implementation.
+    constexpr uint32 tolerance = 2;
+    auto const differences = reference.maxDifferences(readback.data());
+
+    bool matches = true;
+    for (usize level = 0; level < differences.size(); level++)
+    {
+        if (differences[level] > tolerance)
+        {
+            spdlog::error("Mip level {} of '{}' differs from the CPU one by up to {}.", level, path, differences[level]);
+            matches = false;
+        }
+    }
+
+    spdlog::info("Mip chain of '{}' checked: {} levels, largest difference {}.", path, differences.size(),
+                 *std::max_element(differences.begin(), differences.end()));
+
+    return matches ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+// Load OBJ files with `Model`, deduplication included but neither optimization nor levels of detail, and report the
+// vertices of their faces processed per second.
+//
+// Usage: `modelbench [obj...]`, the viking room by default. Cached binary meshes of the files are removed first.
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <limits>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <vector>
+
+#include "vulkan/model.h"
+#include "vulkan_engine.h"
+
+using namespace Engine;
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> paths(argv + 1, argv + argc);
+    if (paths.empty())
+    {
+        paths.emplace_back("resources/models/viking_room.obj");
+    }
+
+    constexpr usize runCount = 5;
+
+    for (auto const &path : paths)
+    {
+        double best = std::numeric_limits<double>::max();
+        usize vertexCount = 0;
+
+        for (usize run = 0; run < runCount; run++)
+        {
+            std::filesystem::remove(path + ".mesh");
+
+            auto const start = std::chrono::steady_clock::now();
+            auto const model = Vulkan::Model::createFromFile(path, false, Vulkan::Model::VertexFormat::Float, {});
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+            vertexCount = model.lods()[0].indexCount;
+        }
+
+        spdlog::info("{}: {} vertices in {:.3f}s at best, {:.0f} vertices/s.", path, vertexCount, best,
+                     static_cast<double>(vertexCount) / best);
+        std::filesystem::remove(path + ".mesh");
+    }
+
+    return 0;
+}
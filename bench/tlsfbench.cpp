@@ -0,0 +1,233 @@
+// Replay an allocate/free trace against the first-fit scan `DeviceAllocator` used to do, and against `Tlsf`.
+//
+// Usage: `tlsfbench [trace]`. Each line of the trace is either `a <id> <size> <alignment>` or `f <id>`. Without a
+// trace, a streaming-like one is generated: sizes from 256B to 4MB, about 20k live resources.
+
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "vulkan/tlsf.h"
+#include "vulkan_engine.h"
+
+using namespace Engine;
+
+namespace
+{
+constexpr VkDeviceSize blockSize = 256 * 1024 * 1024;
+
+struct Operation
+{
+    bool allocate;
+    uint32 id;
+    VkDeviceSize size;
+    VkDeviceSize alignment;
+};
+
+std::vector<Operation> readTrace(std::string const &path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Can not open trace " + path);
+    }
+
+    std::vector<Operation> trace;
+    char type {};
+    while (file >> type)
+    {
+        Operation operation {.allocate = type == 'a'};
+        file >> operation.id;
+        if (operation.allocate)
+        {
+            file >> operation.size >> operation.alignment;
+        }
+        trace.push_back(operation);
+    }
+
+    return trace;
+}
+
+std::vector<Operation> generateTrace(usize operationCount, usize liveCount)
+{
+    std::mt19937_64 random(42);
+    std::uniform_real_distribution<double> sizeLog2(8., 22.);
+
+    std::vector<Operation> trace;
+    std::vector<uint32> live;
+    uint32 nextId = 0;
+
+    while (trace.size() < operationCount)
+    {
+        // Grow to the live count, then churn around it.
+        bool const allocate = live.size() < liveCount / 2 || (live.size() < liveCount * 3 / 2 && random() % 2 == 0);
+        if (allocate)
+        {
+            auto const size = static_cast<VkDeviceSize>(std::exp2(sizeLog2(random)));
+            trace.push_back({.allocate = true, .id = nextId, .size = size, .alignment = 256});
+            live.push_back(nextId++);
+        }
+        else
+        {
+            usize const index = random() % live.size();
+            trace.push_back({.allocate = false, .id = live[index]});
+            live[index] = live.back();
+            live.pop_back();
+        }
+    }
+
+    return trace;
+}
+
+/**
+ * The previous suballocator: ranges rounded to a power of two, found by walking every block and every resource.
+ */
+class FirstFit
+{
+public:
+    void allocate(uint32 id, VkDeviceSize size)
+    {
+        size = std::max<VkDeviceSize>(std::bit_ceil(size), 256);
+
+        for (usize block = 0; block < _blocks.size(); block++)
+        {
+            if (auto offset = allocateIn(_blocks[block], size))
+            {
+                _resources[id] = {block, *offset};
+                return;
+            }
+        }
+
+        _blocks.emplace_back();
+        _resources[id] = {_blocks.size() - 1, *allocateIn(_blocks.back(), size)};
+    }
+
+    void free(uint32 id)
+    {
+        auto const [block, offset] = _resources.at(id);
+        _blocks[block].erase(offset);
+        _resources.erase(id);
+    }
+
+    [[nodiscard]] usize blockCount() const
+    {
+        return _blocks.size();
+    }
+
+private:
+    // map<offset, size>
+    std::vector<std::map<VkDeviceSize, VkDeviceSize>> _blocks;
+    std::unordered_map<uint32, std::pair<usize, VkDeviceSize>> _resources;
+
+    static std::optional<VkDeviceSize> allocateIn(std::map<VkDeviceSize, VkDeviceSize> &block, VkDeviceSize size)
+    {
+        VkDeviceSize previousEnd = 0;
+        for (auto const &[offset, resourceSize] : block)
+        {
+            if (offset - previousEnd >= size)
+            {
+                block.insert({previousEnd, size});
+                return previousEnd;
+            }
+            previousEnd = offset + resourceSize;
+        }
+
+        if (blockSize - previousEnd < size)
+        {
+            return std::nullopt;
+        }
+
+        block.insert({previousEnd, size});
+        return previousEnd;
+    }
+};
+
+/**
+ * The current suballocator: one TLSF per block, blocks tried in order.
+ */
+class TlsfBlocks
+{
+public:
+    void allocate(uint32 id, VkDeviceSize size, VkDeviceSize alignment)
+    {
+        for (usize block = 0; block < _blocks.size(); block++)
+        {
+            if (auto *node = _blocks[block]->allocate(size, alignment))
+            {
+                _resources[id] = {block, node};
+                return;
+            }
+        }
+
+        _blocks.push_back(std::make_unique<Vulkan::Tlsf>(Vulkan::Tlsf::create(blockSize)));
+        _resources[id] = {_blocks.size() - 1, _blocks.back()->allocate(size, alignment)};
+    }
+
+    void free(uint32 id)
+    {
+        auto const [block, node] = _resources.at(id);
+        _blocks[block]->free(node);
+        _resources.erase(id);
+    }
+
+    [[nodiscard]] usize blockCount() const
+    {
+        return _blocks.size();
+    }
+
+private:
+    std::vector<std::unique_ptr<Vulkan::Tlsf>> _blocks;
+    std::unordered_map<uint32, std::pair<usize, Vulkan::Tlsf::Node *>> _resources;
+};
+
+template<typename Allocator, typename Allocate>
+void replay(char const *name, std::vector<Operation> const &trace, Allocator &allocator, Allocate const &allocate)
+{
+    auto const start = std::chrono::steady_clock::now();
+
+    for (auto const &operation : trace)
+    {
+        if (operation.allocate)
+        {
+            allocate(operation);
+        }
+        else
+        {
+            allocator.free(operation.id);
+        }
+    }
+
+    double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    spdlog::info("{}: {} operations in {:.3f}s, {:.0f}ns per operation, {} blocks.", name, trace.size(), seconds,
+                 seconds * 1e9 / static_cast<double>(trace.size()), allocator.blockCount());
+}
+}
+
+int main(int argc, char **argv)
+{
+    auto const trace = argc > 1 ? readTrace(argv[1]) : generateTrace(200'000, 20'000);
+
+    FirstFit firstFit;
+    replay("First fit", trace, firstFit, [&firstFit](Operation const &operation)
+    {
+        firstFit.allocate(operation.id, operation.size);
+    });
+
+    TlsfBlocks tlsf;
+    replay("TLSF", trace, tlsf, [&tlsf](Operation const &operation)
+    {
+        tlsf.allocate(operation.id, operation.size, operation.alignment);
+    });
+
+    return 0;
+}
@@ -5,6 +5,7 @@
 #include "frontend/window.h"
 #include "vulkan/commandbuffer.h"
 #include "vulkan/commandpool.h"
+#include "vulkan/defragmenter.h"
 #include "vulkan/depthstencilimage.h"
 #include "vulkan/framebuffer.h"
 #include "vulkan/instance.h"
@@ -15,10 +16,13 @@
 #include "vulkan/renderpass.h"
 #include "vulkan/sampler.h"
 #include "vulkan/shadermodule.h"
+#include "vulkan/textureloader.h"
 #include "vulkan/swapchainkhr.h"
 #include "vulkan/uniformbuffer.h"
+#include "vulkan/uploadservice.h"
 #include "vulkan/descriptorpool.h"
 #include "vulkan/descriptorset.h"
+#include "vulkan/frameallocator.h"
 #include "vulkan_engine.h"
 
 using namespace Engine;
@@ -80,17 +84,41 @@ int main()
     auto frag = Vulkan::ShaderModule::createFromSpirvFile(&device, "shaders/basic.frag.spv",
                                                           Vulkan::ShaderModule::Stage::Fragment);
 
+    auto graphicsCommandPool = Vulkan::CommandPool::create(&device);
+    auto commandsBuffers = Vulkan::CommandBuffer::createMany(swapchain.views().size(), &device, &graphicsCommandPool);
+
+    // Assets are uploaded on the transfer queue while the first frames are rendered
+    auto uploads = Vulkan::UploadService::create(&device);
+
+    // Texture
+    // Block compressed versions first, when they were baked and the device supports them.
+    std::array<std::string, 3> const texturePaths
+    {
+        "resources/textures/viking_room.bc7.ktx2",
+        "resources/textures/viking_room.astc.ktx2",
+        "resources/textures/viking_room.png",
+    };
+    // Decoded by workers while the model is parsed
+    auto textureLoader = Vulkan::TextureLoader::create(&device, &uploads, Vulkan::TextureCache::create("cache/textures"));
+    auto const textureHandle = textureLoader.load(Vulkan::TextureData::findSupportedFile(&device, texturePaths, VK_IMAGE_TILING_OPTIMAL),
+                                                  VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT);
+
+    // Model
+    auto model = Vulkan::Model::createFromFile("resources/models/viking_room.obj", true, Vulkan::Model::VertexFormat::Quantized);
+    auto modelBuffer = model.toBuffer(&device, uploads);
+
     Vulkan::PipelineBuilder pipeline(std::move(renderPass), surface);
     pipeline.addShaderStage(vert.toPipeline());
     pipeline.addShaderStage(frag.toPipeline());
-    pipeline.setVertexInputDescription<Vulkan::Model>();
+    // The vertex layout depends on the model.
+    pipeline.setVertexInputDescription(model.bindingDescription(), model.attributesDescriptions());
     // Make the pipeline, descriptor sets, descriptor pools and descriptor layouts coherent. They actually are
     // independent objects
     pipeline.addDescriptorSetLayout(
     {
             {
                 .binding = 0,
-                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
                 .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
             },
             {
@@ -101,32 +129,27 @@ int main()
     });
     auto pipelines = Vulkan::PipelineBuilder::build(&device, {&pipeline});
 
-    auto graphicsCommandPool = Vulkan::CommandPool::create(&device);
-    auto commandsBuffers = Vulkan::CommandBuffer::createMany(swapchain.views().size(), &device, &graphicsCommandPool);
-
-    // Texture
-    auto texture = Vulkan::Image::createFromFile("resources/textures/viking_room.png", &device,
-    graphicsCommandPool, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT);
-    auto textureView = Vulkan::ImageView::createFromImage(&texture, &device, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
+    auto &texture = textureLoader.wait(textureHandle);
+    auto textureView = Vulkan::ImageView::createFromImage(&texture, &device, texture.format(), VK_IMAGE_ASPECT_COLOR_BIT);
     auto sampler = Vulkan::Sampler::create(&device);
 
-    // Model
-    auto model = Vulkan::Model::createFromFile("resources/models/viking_room.obj");
-    auto modelBuffer = model.toBuffer(&device, graphicsCommandPool);
+    auto const assetsUploaded = uploads.submit();
+    bool assetsReady = false;
 
-    // UBO
-    std::vector<Vulkan::UniformBuffer> ubos;
-    for (usize i = 0; i < swapchain.views().size(); ++i)
-    {
-        ubos.push_back(std::move(Vulkan::UniformBuffer::create(&device)));
-    }
+    // Per-frame transient data, one region per swapchain image
+    auto frameAllocator = Vulkan::FrameAllocator::create(&device, 64 * 1024, swapchain.views().size());
+
+    device.allocator().logReport();
+    spdlog::debug("Device allocator statistics: {}", device.allocator().statisticsJson());
 
     // Descriptors
     auto descriptorPool = Vulkan::DescriptorPool::create(&device);
-    auto descriptorSets = Vulkan::DescriptorSet::createManyFromBuffers(&device,
-                                                                       &descriptorPool,
-                                                                       pipelines[0].descriptorSetsLayouts()[0],
-                                                                        ubos, sampler, textureView);
+    auto descriptorSet = Vulkan::DescriptorSet::createWithDynamicUniform(&device,
+                                                                         &descriptorPool,
+                                                                         pipelines[0].descriptorSetsLayouts()[0],
+                                                                         frameAllocator.buffer(),
+                                                                         sizeof(Vulkan::UniformBuffer::UniformBufferObject),
+                                                                         sampler, textureView);
 
     // Draw loop
     // todo: properly wrap and destroy those
@@ -149,13 +172,24 @@ int main()
         Vulkan::ThrowError(vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]));
     }
 
+    // Compact device memory a little, every few hundred frames.
+    auto defragmenter = Vulkan::Defragmenter::create(&device, &graphicsCommandPool);
+    constexpr usize defragmentationInterval = 300;
+    constexpr VkDeviceSize defragmentationBudget = 16 * 1024 * 1024;
+
     usize currentFrame = 0;
+    usize frameCount = 0;
     while (!window.shouldClose())
     {
         glfwPollEvents();
 
         vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
 
+        if (++frameCount % defragmentationInterval == 0)
+        {
+            defragmenter.step(defragmentationBudget);
+        }
+
         currentFrame = (currentFrame + 1) % imageInFlightCount;
 
         uint32_t imageIndex = 0;
@@ -176,6 +210,8 @@ int main()
         }
 
         imageInFlight[imageIndex] = inFlightFences[currentFrame];
+        // The device is done with the previous use of this image, so is it with its transient data.
+        frameAllocator.beginFrame(imageIndex);
 
         // update UBO
         glm::quat qPitch = glm::angleAxis(glm::radians(0.f), glm::vec3(1, 0, 0));
@@ -183,24 +219,32 @@ int main()
         glm::quat qRoll = glm::angleAxis(glm::radians(0.f), glm::vec3(0, 0, 1));
         glm::quat orientation = glm::normalize(qPitch * qYaw * qRoll);
 
+        float const fieldOfView = glm::radians(45.f);
         Vulkan::UniformBuffer::UniformBufferObject ubo {};
-        ubo.model = glm::rotate(glm::mat4(1.f), glm::radians(-90.f), glm::vec3(1.f, 0.f, 0.f));
+        ubo.model = glm::rotate(glm::mat4(1.f), glm::radians(-90.f), glm::vec3(1.f, 0.f, 0.f)) * model.dequantization();
         ubo.view = glm::mat4_cast(orientation) * glm::translate(glm::mat4(1.f), {-1.f, -0.5f, 0.f});
-        ubo.proj = glm::perspective(glm::radians(45.f), static_cast<float>(surface.size().width) / static_cast<float>(surface.size().height), 0.001f, 1000.f);
+        ubo.proj = glm::perspective(fieldOfView, static_cast<float>(surface.size().width) / static_cast<float>(surface.size().height), 0.001f, 1000.f);
 
         // GLM was designed for OpenGL, where the Y coordinate of the clip is inverted. Compensate that.
         ubo.proj[1][1] *= -1;
 
-        void *ptr = nullptr;
-        ubos[imageIndex].buffer().map(&ptr);
-        memcpy(ptr, &ubo, sizeof(ubo));
-        ubos[imageIndex].buffer().unmap();
+        auto const uniform = frameAllocator.push(ubo);
+        frameAllocator.flush();
 
         // Create our command buffer now
         auto &commandBuffer = commandsBuffers[imageIndex];
         commandBuffer.reset();
         commandBuffer.begin(0);
 
+        textureLoader.update();
+        uploads.cmdAcquire(commandBuffer);
+        if (!assetsReady && uploads.isComplete(assetsUploaded))
+        {
+            assetsReady = true;
+            // The handle is read again for every frame, nothing to update on relocation.
+            modelBuffer.setRelocatable();
+        }
+
         std::array<VkClearValue, 2> clearValues {};
         clearValues[0].color = {0.f, 0.f, 0.f, 1.f};
         clearValues[1].depthStencil = {1.f, 0};
@@ -221,16 +265,31 @@ int main()
 
         vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[0].pipeline());
-
-        std::array<VkDeviceSize, 1> offsets {0};
-        VkBuffer handle = modelBuffer.handle();
-        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &handle, offsets.data());
-        vkCmdBindIndexBuffer(commandBuffer, handle, model.indexesOffset(), VK_INDEX_TYPE_UINT32);
-        VkDescriptorSet set = descriptorSets[imageIndex];
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[0].layout(), 0, 1, &set, 0, nullptr);
-
-        vkCmdDrawIndexed(commandBuffer, static_cast<uint32>(model.indiceSize()), 1, 0, 0, 0);
+        // Until the assets arrive, only the clear is rendered.
+        if (assetsReady)
+        {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[0].pipeline());
+
+            std::array<VkDeviceSize, 1> offsets {0};
+            VkBuffer handle = modelBuffer.handle();
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &handle, offsets.data());
+            vkCmdBindIndexBuffer(commandBuffer, handle, model.indexesOffset(), model.indexType());
+            VkDescriptorSet set = descriptorSet;
+            auto const uniformOffset = static_cast<uint32>(uniform.offset);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[0].layout(), 0, 1, &set, 1, &uniformOffset);
+
+            // Coarser levels as the model gets further.
+            float const distance = glm::length(glm::vec3(ubo.view * ubo.model * glm::vec4(0.f, 0.f, 0.f, 1.f)));
+            float const projectionScale = static_cast<float>(surface.size().height) / (2.f * std::tan(fieldOfView / 2.f));
+            auto const level = model.selectLod(distance, projectionScale);
+
+            // One draw per material. They all sample the same texture for now.
+            for (usize submesh = 0; submesh < model.submeshes().size(); submesh++)
+            {
+                auto const range = model.submeshRange(level, submesh);
+                vkCmdDrawIndexed(commandBuffer, range.indexCount, 1, range.indexOffset, 0, 0);
+            }
+        }
 
         vkCmdEndRenderPass(commandBuffer);
 
@@ -0,0 +1,109 @@
+#include "mappedfile.h"
+
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace Engine;
+
+MappedFile MappedFile::create(std::filesystem::path const &path)
+{
+    std::error_code error;
+    auto const size = static_cast<usize>(std::filesystem::file_size(path, error));
+    if (error)
+    {
+        throw std::runtime_error("Can not open file: " + path.string());
+    }
+
+    // Mapping nothing is an error for the OS.
+    if (size == 0)
+    {
+        return MappedFile(nullptr, 0);
+    }
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error("Can not open file: " + path.string());
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping)
+    {
+        throw std::runtime_error("Can not map file: " + path.string());
+    }
+
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+    // The view keeps the mapping alive.
+    CloseHandle(mapping);
+    if (!data)
+    {
+        throw std::runtime_error("Can not map file: " + path.string());
+    }
+#else
+    int const file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        throw std::runtime_error("Can not open file: " + path.string());
+    }
+
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+    // The mapping keeps the file alive.
+    close(file);
+    if (data == MAP_FAILED)
+    {
+        throw std::runtime_error("Can not map file: " + path.string());
+    }
+#endif
+
+    return MappedFile(static_cast<std::byte const *>(data), size);
+}
+
+MappedFile::MappedFile(std::byte const *data, usize size) :
+_data(data),
+_size(size)
+{}
+
+MappedFile::~MappedFile()
+{
+    if (!_data)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(_data);
+#else
+    munmap(const_cast<std::byte *>(_data), _size);
+#endif
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept :
+_data(std::exchange(other._data, nullptr)),
+_size(std::exchange(other._size, 0))
+{}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+    std::swap(_data, other._data);
+    std::swap(_size, other._size);
+
+    return *this;
+}
+
+std::span<std::byte const> MappedFile::data() const
+{
+    return {_data, _size};
+}
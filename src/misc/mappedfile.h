@@ -0,0 +1,33 @@
+#ifndef VULKAN_ENGINE_MAPPEDFILE_H
+#define VULKAN_ENGINE_MAPPEDFILE_H
+
+#include <filesystem>
+#include <span>
+
+#include "../vulkan_engine.h"
+
+namespace Engine
+{
+/**
+ * Read only memory mapping of a whole file. Pages are loaded by the OS on first access.
+ */
+class MappedFile : public OnlyMovable
+{
+public:
+    [[nodiscard]] static MappedFile create(std::filesystem::path const &path);
+
+    ~MappedFile();
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    [[nodiscard]] std::span<std::byte const> data() const;
+
+private:
+    MappedFile(std::byte const *data, usize size);
+
+    std::byte const *_data = nullptr;
+    usize _size = 0;
+};
+}
+
+#endif //VULKAN_ENGINE_MAPPEDFILE_H
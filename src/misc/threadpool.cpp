@@ -0,0 +1,74 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+using namespace Engine;
+
+ThreadPool ThreadPool::create(usize threadCount)
+{
+    if (threadCount == 0)
+    {
+        // May be unknown, in which case it is 0.
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    return ThreadPool(threadCount);
+}
+
+ThreadPool::ThreadPool(usize threadCount) :
+_queue(std::make_unique<Queue>())
+{
+    _threads.reserve(threadCount);
+    for (usize i = 0; i < threadCount; ++i)
+    {
+        _threads.emplace_back(work, std::ref(*_queue));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    if (!_queue)
+    {
+        return;
+    }
+
+    {
+        std::scoped_lock lock(_queue->mutex);
+        _queue->stopping = true;
+        _queue->tasks.clear();
+    }
+    _queue->available.notify_all();
+
+    for (auto &thread : _threads)
+    {
+        thread.join();
+    }
+}
+
+usize ThreadPool::threadCount() const
+{
+    return _threads.size();
+}
+
+void ThreadPool::work(Queue &queue)
+{
+    while (true)
+    {
+        std::function<void()> task;
+
+        {
+            std::unique_lock lock(queue.mutex);
+            queue.available.wait(lock, [&queue]() { return queue.stopping || !queue.tasks.empty(); });
+
+            if (queue.stopping)
+            {
+                return;
+            }
+
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+
+        task();
+    }
+}
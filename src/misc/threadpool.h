@@ -0,0 +1,74 @@
+#ifndef VULKAN_ENGINE_THREADPOOL_H
+#define VULKAN_ENGINE_THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "../vulkan_engine.h"
+
+namespace Engine
+{
+/**
+ * Fixed set of worker threads running tasks in submission order.
+ */
+class ThreadPool : public OnlyMovable
+{
+public:
+    /**
+     * @param threadCount Number of workers, one per hardware thread if 0.
+     */
+    [[nodiscard]] static ThreadPool create(usize threadCount = 0);
+
+    /**
+     * Wait for the running tasks to finish. Queued tasks are dropped, their futures report a broken promise.
+     */
+    ~ThreadPool();
+    ThreadPool(ThreadPool &&) noexcept = default;
+    // Assigning would have to stop the workers of the assigned pool first.
+    ThreadPool &operator=(ThreadPool &&) = delete;
+
+    template <class F>
+    std::future<std::invoke_result_t<F>> submit(F &&function)
+    {
+        // std::function needs copyable callables, a packaged task isn't.
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(function));
+        auto future = task->get_future();
+
+        {
+            std::scoped_lock lock(_queue->mutex);
+            _queue->tasks.emplace_back([task]() { (*task)(); });
+        }
+        _queue->available.notify_one();
+
+        return future;
+    }
+
+    [[nodiscard]] usize threadCount() const;
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::condition_variable available;
+        std::deque<std::function<void()>> tasks;
+        bool stopping = false;
+    };
+
+    explicit ThreadPool(usize threadCount);
+
+    // Workers keep a pointer to the queue, which must not move with the pool.
+    std::unique_ptr<Queue> _queue;
+    std::vector<std::thread> _threads;
+
+    static void work(Queue &queue);
+};
+}
+
+#endif //VULKAN_ENGINE_THREADPOOL_H
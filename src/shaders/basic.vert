@@ -3,6 +3,7 @@
 
 layout(binding = 0) uniform UniformBufferObject
 {
+    // Includes the dequantization of positions, when they are quantized.
     mat4 model;
     mat4 view;
     mat4 proj;
@@ -1,8 +1,11 @@
 #include "buffer.h"
 
+#include <algorithm>
+#include <utility>
+
 using namespace Engine::Vulkan;
 
-Buffer Buffer::create(not_null<LogicalDevice *> device, VkBufferUsageFlags usage, VkDeviceSize size, VkMemoryPropertyFlags properties)
+Buffer Buffer::create(not_null<LogicalDevice *> device, VkBufferUsageFlags usage, VkDeviceSize size, DeviceAllocator::MemoryUsage memoryUsage)
 {
     VkBufferCreateInfo bufferInfo
     {
@@ -15,26 +18,81 @@ Buffer Buffer::create(not_null<LogicalDevice *> device, VkBufferUsageFlags usage
     VkBuffer buffer = VK_NULL_HANDLE;
     ThrowError(vkCreateBuffer(*device, &bufferInfo, nullptr, &buffer));
 
-    VkMemoryRequirements requirements {};
-    vkGetBufferMemoryRequirements(*device, buffer, &requirements);
-
-    auto alloc = device->allocator().allocate(requirements, properties);
+    auto alloc = device->allocator().allocateForBuffer(buffer, memoryUsage);
 
     ThrowError(vkBindBufferMemory(*device, buffer, alloc.memory, alloc.offset));
 
-    return Buffer(buffer, alloc, device);
+    return Buffer(buffer, size, usage, alloc, device);
 }
 
-Buffer::Buffer(VkHandle<VkBuffer> buffer, DeviceAllocator::ResourceMemory allocation, not_null<LogicalDevice *> device) :
+Buffer::Buffer(VkHandle<VkBuffer> buffer, VkDeviceSize size, VkBufferUsageFlags usage, DeviceAllocator::ResourceMemory allocation,
+               not_null<LogicalDevice *> device) :
     _buffer(std::move(buffer)),
+    _size(size),
+    _usage(usage),
     _allocation(allocation),
     _device(device)
 {}
 
+Buffer::Buffer(Buffer &&other) :
+    _buffer(std::move(other._buffer)),
+    _size(other._size),
+    _usage(other._usage),
+    _allocation(other._allocation),
+    _device(other._device),
+    _relocatable(other._relocatable),
+    _onRelocated(std::move(other._onRelocated)),
+    _relocation(std::exchange(other._relocation, std::nullopt))
+{
+    // The allocator calls the owner back through its address.
+    if (_buffer && _relocatable)
+    {
+        _device->allocator().setRelocatable(_allocation, this);
+    }
+
+    if (_relocation)
+    {
+        _device->allocator().setRelocatable(_relocation->memory, this);
+    }
+}
+
+Buffer &Buffer::operator=(Buffer &&other)
+{
+    std::swap(_buffer, other._buffer);
+    std::swap(_size, other._size);
+    std::swap(_usage, other._usage);
+    std::swap(_allocation, other._allocation);
+    std::swap(_device, other._device);
+    std::swap(_relocatable, other._relocatable);
+    std::swap(_onRelocated, other._onRelocated);
+    std::swap(_relocation, other._relocation);
+
+    for (Buffer *buffer : {this, &other})
+    {
+        if (buffer->_buffer && buffer->_relocatable)
+        {
+            buffer->_device->allocator().setRelocatable(buffer->_allocation, buffer);
+        }
+
+        if (buffer->_relocation)
+        {
+            buffer->_device->allocator().setRelocatable(buffer->_relocation->memory, buffer);
+        }
+    }
+
+    return *this;
+}
+
 Buffer::~Buffer()
 {
     if (_buffer)
     {
+        // The range may be reused, the defragmenter must not call us back through it.
+        if (_relocatable)
+        {
+            _device->allocator().setRelocatable(_allocation, nullptr);
+        }
+
         vkDestroyBuffer(*_device, _buffer, nullptr);
         _device->allocator().free(_allocation);
     }
@@ -45,14 +103,90 @@ Buffer::operator VkBuffer () const
     return _buffer;
 }
 
-void Buffer::map(void **ptr)
+std::span<std::byte> Buffer::data() const
+{
+    // The allocation may be larger than the buffer because of alignment.
+    return _allocation.mapped.first(std::min<usize>(_allocation.mapped.size(), _size));
+}
+
+void Buffer::flush(VkDeviceSize offset, VkDeviceSize size)
+{
+    _device->allocator().flush(_allocation, offset, size);
+}
+
+void Buffer::invalidate(VkDeviceSize offset, VkDeviceSize size)
+{
+    _device->allocator().invalidate(_allocation, offset, size);
+}
+
+void Buffer::setRelocatable(std::function<void(Buffer &)> onRelocated)
+{
+    if (!(_usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT))
+    {
+        throw std::runtime_error("Relocatable buffers must be transfer sources.");
+    }
+
+    _relocatable = true;
+    _onRelocated = std::move(onRelocated);
+    _device->allocator().setRelocatable(_allocation, this);
+}
+
+bool Buffer::prepareRelocation(DeviceAllocator::ResourceMemory const &destination)
 {
-    ThrowError(vkMapMemory(*_device, _allocation.memory, _allocation.offset, _allocation.size, 0, ptr));
+    VkBufferCreateInfo bufferInfo
+    {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = _size,
+        .usage = _usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    ThrowError(vkCreateBuffer(*_device, &bufferInfo, nullptr, &buffer));
+
+    // The destination was planned for the old buffer, the transfer destination usage may change the requirements.
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(*_device, buffer, &requirements);
+
+    if (!(requirements.memoryTypeBits & (1u << destination.memoryType())) || destination.offset % requirements.alignment != 0 ||
+        requirements.size > destination.size)
+    {
+        vkDestroyBuffer(*_device, buffer, nullptr);
+        return false;
+    }
+
+    ThrowError(vkBindBufferMemory(*_device, buffer, destination.memory, destination.offset));
+
+    _relocation.emplace(PendingRelocation {buffer, destination});
+
+    return true;
+}
+
+void Buffer::recordRelocation(VkCommandBuffer commandBuffer)
+{
+    VkBufferCopy copyRegion {.srcOffset = 0, .dstOffset = 0, .size = _size};
+    vkCmdCopyBuffer(commandBuffer, _buffer, _relocation->buffer, 1, &copyRegion);
 }
 
-void Buffer::unmap()
+void Buffer::cancelRelocation()
 {
-    vkUnmapMemory(*_device, _allocation.memory);
+    vkDestroyBuffer(*_device, _relocation->buffer, nullptr);
+    _relocation.reset();
+}
+
+void Buffer::completeRelocation()
+{
+    vkDestroyBuffer(*_device, _buffer, nullptr);
+    _device->allocator().free(_allocation);
+
+    _buffer = std::move(_relocation->buffer);
+    _allocation = _relocation->memory;
+    _relocation.reset();
+
+    if (_onRelocated)
+    {
+        _onRelocated(*this);
+    }
 }
 
 void Buffer::cmdCopy(CommandBuffer &commandBuffer, Buffer &dst, Buffer &src, VkDeviceSize size)
@@ -1,36 +1,77 @@
 #ifndef VULKAN_ENGINE_BUFFER_H
 #define VULKAN_ENGINE_BUFFER_H
 
+#include <functional>
+#include <optional>
+#include <span>
+
 #include "vulkan.h"
 #include "logicaldevice.h"
 #include "commandbuffer.h"
 
 namespace Engine::Vulkan
 {
-class Buffer : OnlyMovable
+class Buffer : OnlyMovable, public DeviceAllocator::Relocatable
 {
 public:
     [[nodiscard]] static Buffer create(not_null<LogicalDevice*> device, VkBufferUsageFlags usage, VkDeviceSize size,
-                                       VkMemoryPropertyFlags properties);
+                                       DeviceAllocator::MemoryUsage memoryUsage);
 
     static void cmdCopy(CommandBuffer &commandBuffer, Buffer &dst, Buffer &src, VkDeviceSize size);
 
-    ~Buffer();
-    Buffer(Buffer &&) = default;
-    Buffer &operator=(Buffer &&) = default;
+    ~Buffer() override;
+    Buffer(Buffer &&other);
+    Buffer &operator=(Buffer &&other);
     operator VkBuffer() const;
 
     VkBuffer handle();
-    void map(void **ptr);
-    void unmap();
+    /**
+     * Host view of the buffer content, mapped for the whole lifetime of the buffer.
+     * Empty if the buffer isn't host visible.
+     */
+    [[nodiscard]] std::span<std::byte> data() const;
+    /**
+     * Make host writes visible to the device. Only needed for memory that isn't host coherent.
+     */
+    void flush(VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+    /**
+     * Make device writes visible to the host. Only needed for memory that isn't host coherent.
+     */
+    void invalidate(VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+
+    /**
+     * Let the defragmenter move this buffer. Its handle changes when it does: `onRelocated` is then called so
+     * descriptors referencing the buffer can be updated.
+     *
+     * The buffer must have been created with `VK_BUFFER_USAGE_TRANSFER_SRC_BIT`.
+     */
+    void setRelocatable(std::function<void(Buffer &)> onRelocated = {});
+
+    bool prepareRelocation(DeviceAllocator::ResourceMemory const &destination) override;
+    void recordRelocation(VkCommandBuffer commandBuffer) override;
+    void cancelRelocation() override;
+    void completeRelocation() override;
 
 private:
-    Buffer(VkHandle<VkBuffer> buffer, DeviceAllocator::ResourceMemory allocation, not_null<LogicalDevice*> device);
+    struct PendingRelocation
+    {
+        VkHandle<VkBuffer> buffer;
+        DeviceAllocator::ResourceMemory memory;
+    };
+
+    Buffer(VkHandle<VkBuffer> buffer, VkDeviceSize size, VkBufferUsageFlags usage, DeviceAllocator::ResourceMemory allocation,
+           not_null<LogicalDevice*> device);
 
     VkHandle<VkBuffer> _buffer;
+    VkDeviceSize _size;
+    VkBufferUsageFlags _usage;
     DeviceAllocator::ResourceMemory _allocation;
 
     not_null<LogicalDevice*> _device;
+
+    bool _relocatable = false;
+    std::function<void(Buffer &)> _onRelocated;
+    std::optional<PendingRelocation> _relocation;
 };
 }
 
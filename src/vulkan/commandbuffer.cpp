@@ -85,6 +85,20 @@ void CommandBuffer::submit(bool wait)
     }
 }
 
+void CommandBuffer::submit(VkQueue queue, VkFence fence)
+{
+    VkCommandBuffer cmdBuffer = _commandBuffer;
+
+    VkSubmitInfo submitInfo
+    {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmdBuffer,
+    };
+
+    ThrowError(vkQueueSubmit(queue, 1, &submitInfo, fence));
+}
+
 CommandBuffer::operator VkCommandBuffer() const
 {
     return _commandBuffer;
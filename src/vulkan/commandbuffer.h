@@ -27,6 +27,10 @@ public:
     // Make that function static to submit multiples at once.
     // Make an efficient asynchronous queues model.
     void submit(bool wait = false);
+    /**
+     * Submit to `queue`, which must belong to the queue family of the command pool. `fence` may be null.
+     */
+    void submit(VkQueue queue, VkFence fence);
 
     void reset();
 
@@ -4,7 +4,11 @@ using namespace Engine::Vulkan;
 
 CommandPool CommandPool::create(not_null<LogicalDevice*> device)
 {
-    uint32 queueFamily = device->queueFamilies().graphics.value();
+    return create(device, device->queueFamilies().graphics.value());
+}
+
+CommandPool CommandPool::create(not_null<LogicalDevice*> device, uint32 queueFamily)
+{
     VkCommandPoolCreateInfo poolInfo {};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     poolInfo.queueFamilyIndex = queueFamily;
@@ -9,7 +9,11 @@ namespace Engine::Vulkan
 class CommandPool : public OnlyMovable
 {
 public:
+    /**
+     * Pool for the graphics queue family.
+     */
     [[nodiscard]] static CommandPool create(not_null<LogicalDevice*> device);
+    [[nodiscard]] static CommandPool create(not_null<LogicalDevice*> device, uint32 queueFamily);
 
     ~CommandPool();
     CommandPool(CommandPool &&) noexcept = default;
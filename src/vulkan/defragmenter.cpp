@@ -0,0 +1,118 @@
+#include "defragmenter.h"
+#include "commandbuffer.h"
+
+#include <unordered_set>
+#include <vector>
+
+using namespace Engine::Vulkan;
+
+Defragmenter Defragmenter::create(not_null<LogicalDevice *> device, not_null<CommandPool *> commandPool)
+{
+    return Defragmenter(device, commandPool);
+}
+
+Defragmenter::Defragmenter(not_null<LogicalDevice *> device, not_null<CommandPool *> commandPool) :
+_device(device),
+_commandPool(commandPool)
+{}
+
+VkDeviceSize Defragmenter::step(VkDeviceSize byteBudget)
+{
+    auto &allocator = _device->allocator();
+
+    auto relocations = allocator.planDefragmentation(byteBudget);
+    if (relocations.empty())
+    {
+        return 0;
+    }
+
+    // A block stays alive if any of its resources can't move, the other moves out of it would be wasted.
+    std::unordered_set<VkDeviceMemory> stuckBlocks;
+    std::vector<bool> prepared(relocations.size());
+
+    for (usize i = 0; i < relocations.size(); ++i)
+    {
+        auto const &[owner, source, destination] = relocations[i];
+        if (stuckBlocks.contains(source.memory))
+        {
+            continue;
+        }
+
+        prepared[i] = owner->prepareRelocation(destination);
+        if (!prepared[i])
+        {
+            stuckBlocks.insert(source.memory);
+
+            // Pinned, so the block isn't planned again for a move which would fail the same way.
+            allocator.setRelocatable(source, nullptr);
+        }
+    }
+
+    std::vector<DeviceAllocator::Relocatable *> moved;
+    VkDeviceSize movedSize = 0;
+
+    for (usize i = 0; i < relocations.size(); ++i)
+    {
+        auto const &[owner, source, destination] = relocations[i];
+        if (!stuckBlocks.contains(source.memory))
+        {
+            moved.push_back(owner);
+            movedSize += destination.size;
+            continue;
+        }
+
+        if (prepared[i])
+        {
+            owner->cancelRelocation();
+        }
+        allocator.free(destination);
+    }
+
+    if (moved.empty())
+    {
+        return 0;
+    }
+
+    auto commandBuffer = CommandBuffer::create(_device, _commandPool);
+    commandBuffer.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+    // Previous frames may still be writing the resources about to be copied.
+    VkMemoryBarrier const beforeCopies
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         1, &beforeCopies, 0, nullptr, 0, nullptr);
+
+    for (auto *owner : moved)
+    {
+        owner->recordRelocation(commandBuffer);
+    }
+
+    VkMemoryBarrier const afterCopies
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                         1, &afterCopies, 0, nullptr, 0, nullptr);
+
+    commandBuffer.end();
+    commandBuffer.submit(true);
+
+    // Nothing uses the old resources anymore.
+    for (auto *owner : moved)
+    {
+        owner->completeRelocation();
+    }
+
+    // Old ranges freed through thread caches would keep their blocks alive.
+    allocator.trim();
+
+    spdlog::debug("Defragmentation moved {}KB in {} resources.", movedSize / 1000, moved.size());
+
+    return movedSize;
+}
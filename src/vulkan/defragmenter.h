@@ -0,0 +1,42 @@
+#ifndef VULKAN_ENGINE_DEFRAGMENTER_H
+#define VULKAN_ENGINE_DEFRAGMENTER_H
+
+#include "vulkan.h"
+#include "logicaldevice.h"
+#include "commandpool.h"
+
+namespace Engine::Vulkan
+{
+/**
+ * Incrementally compact the blocks of a `DeviceAllocator`.
+ *
+ * Each step moves a bounded number of bytes of relocatable resources (see `Buffer::setRelocatable()` and
+ * `Image::setRelocatable()`) from the sparsest blocks into denser ones, with device copies. Blocks emptied that way
+ * are released by the allocator.
+ */
+class Defragmenter : public OnlyMovable
+{
+public:
+    [[nodiscard]] static Defragmenter create(not_null<LogicalDevice*> device, not_null<CommandPool*> commandPool);
+
+    /**
+     * Move at most `byteBudget` bytes, or a single resource bigger than that.
+     *
+     * A block is emptied over as many steps as its resources need. If one of them can't be moved, it is pinned and
+     * nothing else leaves its block.
+     *
+     * It waits for the device to be idle before switching resources, so call it between frames.
+     *
+     * @return The number of bytes moved.
+     */
+    VkDeviceSize step(VkDeviceSize byteBudget);
+
+private:
+    Defragmenter(not_null<LogicalDevice*> device, not_null<CommandPool*> commandPool);
+
+    not_null<LogicalDevice*> _device;
+    not_null<CommandPool*> _commandPool;
+};
+}
+
+#endif //VULKAN_ENGINE_DEFRAGMENTER_H
@@ -96,3 +96,60 @@ std::vector<DescriptorSet> DescriptorSet::createManyFromBuffers(not_null<Logical
     return result;
 }
 
+
+DescriptorSet DescriptorSet::createWithDynamicUniform(not_null<LogicalDevice*> device,
+                                                      not_null<DescriptorPool*> pool,
+                                                      not_null<VkDescriptorSetLayout> layout,
+                                                      VkBuffer buffer, VkDeviceSize range,
+                                                      Sampler &sampler, ImageView &imageView)
+{
+    VkDescriptorSetLayout setLayout = layout;
+    VkDescriptorSetAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = *pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &setLayout;
+
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    ThrowError(vkAllocateDescriptorSets(*device, &allocInfo, &descriptorSet));
+
+    VkDescriptorBufferInfo bufferInfo
+    {
+        .buffer = buffer,
+        .offset = 0,
+        .range = range
+    };
+
+    VkDescriptorImageInfo imageInfo
+    {
+        .sampler = sampler,
+        .imageView = imageView,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+
+    std::array<VkWriteDescriptorSet, 2> writesInfos
+    {
+        VkWriteDescriptorSet {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSet,
+            .dstBinding = 0,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .pBufferInfo = &bufferInfo,
+        },
+        VkWriteDescriptorSet {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptorSet,
+            .dstBinding = 1,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &imageInfo,
+        },
+    };
+
+    vkUpdateDescriptorSets(*device, static_cast<uint32>(writesInfos.size()), writesInfos.data(), 0, nullptr);
+
+    return DescriptorSet(descriptorSet, device, pool);
+}
@@ -17,6 +17,14 @@ public:
                                                                           not_null<DescriptorPool*> pool, not_null<VkDescriptorSetLayout> layout,
                                                                           std::vector<Vulkan::UniformBuffer> &buffers,
                                                                           Sampler &sampler, ImageView &imageView);
+    /**
+     * Single set whose binding 0 is a dynamic uniform buffer of `range` bytes inside `buffer`, typically a
+     * `FrameAllocator` buffer. The offset of each frame's data is given at bind time.
+     */
+    [[nodiscard]] static DescriptorSet createWithDynamicUniform(not_null<LogicalDevice*> device,
+                                                                not_null<DescriptorPool*> pool, not_null<VkDescriptorSetLayout> layout,
+                                                                VkBuffer buffer, VkDeviceSize range,
+                                                                Sampler &sampler, ImageView &imageView);
 
     ~DescriptorSet();
     DescriptorSet(DescriptorSet &&) = default;
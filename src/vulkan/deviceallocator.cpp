@@ -2,50 +2,107 @@
 #include "logicaldevice.h"
 
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <iterator>
+
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/fmt/ranges.h>
 
 using namespace Engine::Vulkan;
 
+/**
+ * Only used to report how much memory the previous power-of-two suballocation scheme would have consumed.
+ */
+static VkDeviceSize legacyRoundedSize(VkDeviceSize size)
+{
+    --size;
+    size |= size >> 1u;
+    size |= size >> 2u;
+    size |= size >> 4u;
+    size |= size >> 8u;
+    size |= size >> 16u;
+    size |= size >> 32u;
+    ++size;
+
+    return std::max(size, uint64 {256u});
+}
+
+static std::atomic<uint64> nextAllocatorId = 0;
+
 DeviceAllocator DeviceAllocator::create(not_null<LogicalDevice *> device)
 {
     return DeviceAllocator(device);
 }
 
 DeviceAllocator::DeviceAllocator(not_null<LogicalDevice *> device) :
-_device(device)
+_device(device),
+_id(nextAllocatorId++),
+_memories(device->memories()),
+_bufferImageGranularity(device->properties().limits.bufferImageGranularity),
+_nonCoherentAtomSize(device->properties().limits.nonCoherentAtomSize)
 {
-    VkPhysicalDeviceMemoryProperties const memories = _device->memories();
-
     // Populate _heaps object
-    for (uint32 i = 0; i < memories.memoryHeapCount; ++i)
+    for (uint32 i = 0; i < _memories.memoryHeapCount; ++i)
     {
         Heap heap
         {
-            .size = memories.memoryHeaps[i].size,
+            .size = _memories.memoryHeaps[i].size,
+            .maxAllocationSize = std::min(maxAllocationSize, _memories.memoryHeaps[i].size / heapFraction),
         };
         _heaps.push_back(std::move(heap));
     }
+
+    if (_device->isExtensionEnabled(VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME) &&
+        _device->isExtensionEnabled(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME))
+    {
+        _getBufferMemoryRequirements2 = reinterpret_cast<PFN_vkGetBufferMemoryRequirements2KHR>(
+            vkGetDeviceProcAddr(*_device, "vkGetBufferMemoryRequirements2KHR"));
+        _getImageMemoryRequirements2 = reinterpret_cast<PFN_vkGetImageMemoryRequirements2KHR>(
+            vkGetDeviceProcAddr(*_device, "vkGetImageMemoryRequirements2KHR"));
+    }
 }
 
 DeviceAllocator::~DeviceAllocator()
 {
+    // Moved-from allocators own nothing.
+    if (!_mutex)
+    {
+        return;
+    }
+
+    std::lock_guard lock(*_mutex);
+    drainThreadCaches();
+
     for (size_t heapIndex = 0; heapIndex < _heaps.size(); ++heapIndex)
     {
         auto &heap = _heaps[heapIndex];
 
-        for (auto &allocation : heap.allocations)
+        for (auto const &allocation : heap.allocations)
         {
-            if (!allocation.resources.empty())
+            if (!allocation->resources.empty())
             {
                 spdlog::error("GPU allocation leak:");
-                for (auto const &suballocation : allocation.resources)
+                for (auto const &suballocation : allocation->resources)
                 {
-                    spdlog::error("    Heap: {}, Offset: {}, Size: {}", heapIndex, suballocation.first, suballocation.second);
+                    spdlog::error("    Heap: {}, Offset: {}, Size: {}", heapIndex, suballocation.first, suballocation.second.node->size);
                 }
             }
 
-            vkFreeMemory(*_device, allocation.memory, nullptr);
-            heap.allocatedSize -= allocation.size;
-            spdlog::debug("Freed {}MB (total: {}MB).", allocationSize / 1000000, totalDeviceAllocation() / 1000000);
+            // Freeing memory implicitly unmaps it.
+            vkFreeMemory(*_device, allocation->memory, nullptr);
+            heap.allocatedSize -= allocation->size;
+            spdlog::debug("Freed {}MB (total: {}MB).", allocation->size / 1000000, allocatedSizeLocked() / 1000000);
+        }
+
+        for (auto const &[memory, dedicated] : heap.dedicatedAllocations)
+        {
+            spdlog::error("GPU allocation leak:");
+            spdlog::error("    Heap: {}, Dedicated, Size: {}", heapIndex, dedicated.size);
+
+            vkFreeMemory(*_device, memory, nullptr);
+            heap.allocatedSize -= dedicated.size;
         }
     }
 
@@ -54,152 +111,675 @@ DeviceAllocator::~DeviceAllocator()
 
 void DeviceAllocator::free(ResourceMemory const &resource)
 {
-    auto allocation = std::find_if(_heaps[resource._heap].allocations.begin(), _heaps[resource._heap].allocations.end(), [&resource](Allocation &allocation)
+    if (giveToThreadCache(resource))
     {
-        return allocation.memory == resource.memory;
-    });
+        return;
+    }
+
+    std::lock_guard lock(*_mutex);
+    freeLocked(resource);
+}
 
-    if (allocation == _heaps[resource._heap].allocations.end())
+void DeviceAllocator::freeLocked(ResourceMemory const &resource)
+{
+    if (resource._dedicated)
     {
-        throw std::runtime_error("Tried to free unknown resource.");
+        Heap &heap = _heaps[resource._heap];
+        if (heap.dedicatedAllocations.erase(resource.memory) == 0)
+        {
+            throw std::runtime_error("Tried to free unknown resource.");
+        }
+
+        vkFreeMemory(*_device, resource.memory, nullptr);
+        heap.allocatedSize -= resource.size;
+        _requestedSize -= resource.size;
+        _roundedSize -= legacyRoundedSize(resource.size);
+
+        spdlog::debug("Freed dedicated {}MB (total: {}MB).", resource.size / 1000000, allocatedSizeLocked() / 1000000);
+        return;
     }
 
-    auto rawResource = allocation->resources.find(resource.offset);
-    if (rawResource == allocation->resources.end())
+    assertExclusive(resource);
+
+    // The resource knows its block and range: nothing to search.
+    Allocation *allocation = resource._allocation;
+    if (resource._node->isFree || allocation->resources.erase(resource.offset) == 0)
     {
         throw std::runtime_error("Tried to free unknown resource.");
     }
-    allocation->resources.erase(rawResource);
+
+    allocation->blocks.free(resource._node);
     allocation->subAllocatedSize -= resource.size;
+    _requestedSize -= resource.size;
+    _roundedSize -= legacyRoundedSize(resource.size);
 
     spdlog::trace("Subfreed {}KB.", resource.size / 1000);
+
+    if (allocation->blocks.empty())
+    {
+        releaseEmptyAllocation(resource._heap, allocation);
+    }
 }
 
-DeviceAllocator::ResourceMemory DeviceAllocator::allocate(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties)
+void DeviceAllocator::assertExclusive([[maybe_unused]] ResourceMemory const &resource) const
 {
-    if (requirements.size > allocationSize)
+#ifndef NDEBUG
+    if (resource._dedicated)
     {
-        throw std::runtime_error("Requested allocation size is higher than maximum allocation size allowed.");
+        return;
     }
 
-    auto memoryType = findMemoryType(requirements, properties);
+    Tlsf::Node const *node = resource._node;
+    assert(!node->isFree && "Suballocation already free.");
+    assert(resource._allocation->resources.at(resource.offset).node == node && "Suballocation given to another resource.");
+    assert(node->offset <= resource.offset && resource.offset + resource.size <= node->offset + node->size);
+    assert((!node->previousPhysical || node->previousPhysical->offset + node->previousPhysical->size <= node->offset) &&
+           "Suballocation overlaps the previous one.");
+    assert((!node->nextPhysical || node->offset + node->size <= node->nextPhysical->offset) &&
+           "Suballocation overlaps the next one.");
+#endif
+}
 
-    auto suballocation = suballocateMemory(memoryType, requirements);
+DeviceAllocator::ResourceMemory DeviceAllocator::allocate(VkMemoryRequirements requirements, MemoryUsage usage, Tiling tiling)
+{
+    return allocateResource({.memory = requirements}, usage, tiling, VK_NULL_HANDLE, VK_NULL_HANDLE);
+}
 
-    if (!suballocation)
+void DeviceAllocator::flush(ResourceMemory const &resource, VkDeviceSize offset, VkDeviceSize size)
+{
+    if (auto const range = nonCoherentRange(resource, offset, size))
     {
-        allocateMemory(memoryType);
-        suballocation = suballocateMemory(memoryType, requirements);
+        ThrowError(vkFlushMappedMemoryRanges(*_device, 1, &*range));
+    }
+}
+
+void DeviceAllocator::invalidate(ResourceMemory const &resource, VkDeviceSize offset, VkDeviceSize size)
+{
+    if (auto const range = nonCoherentRange(resource, offset, size))
+    {
+        ThrowError(vkInvalidateMappedMemoryRanges(*_device, 1, &*range));
+    }
+}
+
+DeviceAllocator::ResourceMemory DeviceAllocator::allocateForBuffer(VkBuffer buffer, MemoryUsage usage)
+{
+    Requirements requirements {};
+
+    if (_getBufferMemoryRequirements2)
+    {
+        VkMemoryDedicatedRequirementsKHR dedicatedRequirements
+        {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR,
+        };
+        VkMemoryRequirements2KHR memoryRequirements
+        {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR,
+            .pNext = &dedicatedRequirements,
+        };
+        VkBufferMemoryRequirementsInfo2KHR info
+        {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2_KHR,
+            .buffer = buffer,
+        };
+        _getBufferMemoryRequirements2(*_device, &info, &memoryRequirements);
+
+        requirements.memory = memoryRequirements.memoryRequirements;
+        requirements.prefersDedicated = dedicatedRequirements.prefersDedicatedAllocation;
+        requirements.requiresDedicated = dedicatedRequirements.requiresDedicatedAllocation;
+    }
+    else
+    {
+        vkGetBufferMemoryRequirements(*_device, buffer, &requirements.memory);
+    }
+
+    return allocateResource(requirements, usage, Tiling::Linear, buffer, VK_NULL_HANDLE);
+}
+
+DeviceAllocator::ResourceMemory DeviceAllocator::allocateForImage(VkImage image, MemoryUsage usage, Tiling tiling)
+{
+    Requirements requirements {};
+
+    if (_getImageMemoryRequirements2)
+    {
+        VkMemoryDedicatedRequirementsKHR dedicatedRequirements
+        {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR,
+        };
+        VkMemoryRequirements2KHR memoryRequirements
+        {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR,
+            .pNext = &dedicatedRequirements,
+        };
+        VkImageMemoryRequirementsInfo2KHR info
+        {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2_KHR,
+            .image = image,
+        };
+        _getImageMemoryRequirements2(*_device, &info, &memoryRequirements);
+
+        requirements.memory = memoryRequirements.memoryRequirements;
+        requirements.prefersDedicated = dedicatedRequirements.prefersDedicatedAllocation;
+        requirements.requiresDedicated = dedicatedRequirements.requiresDedicatedAllocation;
+    }
+    else
+    {
+        vkGetImageMemoryRequirements(*_device, image, &requirements.memory);
+    }
+
+    return allocateResource(requirements, usage, tiling, VK_NULL_HANDLE, image);
+}
+
+DeviceAllocator::ResourceMemory DeviceAllocator::allocateResource(Requirements requirements, MemoryUsage usage,
+                                                                  Tiling tiling, VkBuffer buffer, VkImage image)
+{
+    // Try every compatible memory type, best first, before giving up.
+    for (auto const &memoryType : findMemoryTypes(requirements.memory.memoryTypeBits, usage))
+    {
+        if (auto resource = allocateResourceInType(memoryType, requirements, tiling, buffer, image))
+        {
+            return *resource;
+        }
+
+        spdlog::debug("Memory type {} is full, falling back to the next one.", std::get<0>(memoryType));
+    }
+
+    throw std::runtime_error("Could not allocate memory.");
+}
+
+std::optional<DeviceAllocator::ResourceMemory> DeviceAllocator::allocateResourceInType(MemorySection memoryType, Requirements requirements,
+                                                                                       Tiling tiling, VkBuffer buffer, VkImage image)
+{
+    // Keep non-coherent resources on their own atoms, so flushing one never writes back a neighbour.
+    if (!isCoherent(std::get<0>(memoryType)))
+    {
+        requirements.memory.alignment = std::max(requirements.memory.alignment, _nonCoherentAtomSize);
+        requirements.memory.size = (requirements.memory.size + _nonCoherentAtomSize - 1) / _nonCoherentAtomSize * _nonCoherentAtomSize;
+    }
+
+    // Above half a block, a resource would pin most of a big-allocation on its own.
+    VkDeviceSize const dedicatedThreshold = _heaps[std::get<1>(memoryType)].maxAllocationSize / 2;
+    bool const dedicated = requirements.requiresDedicated || requirements.prefersDedicated ||
+                           requirements.memory.size > dedicatedThreshold;
+
+    // Small sizes are rounded so freed ranges can be reused by other requests of the same class.
+    if (!dedicated && requirements.memory.size <= smallSizeThreshold)
+    {
+        requirements.memory.size = (requirements.memory.size + smallSizeGranularity - 1) / smallSizeGranularity * smallSizeGranularity;
+
+        if (auto cached = takeFromThreadCache(std::get<0>(memoryType), tiling, requirements.memory))
+        {
+            return cached;
+        }
+    }
+
+    std::lock_guard lock(*_mutex);
+    std::optional<ResourceMemory> suballocation;
+
+    if (dedicated)
+    {
+        suballocation = allocateDedicatedMemory(memoryType, tiling, requirements.memory, buffer, image);
+    }
+    else
+    {
+        suballocation = suballocateMemory(memoryType, requirements.memory, tiling);
+
+        // Cached ranges may be enough to satisfy the request, or to let it fit in an existing block.
+        if (!suballocation && !_threadCaches.empty())
+        {
+            drainThreadCaches();
+            suballocation = suballocateMemory(memoryType, requirements.memory, tiling);
+        }
+
+        if (!suballocation && allocateMemory(memoryType, tiling, requirements.memory))
+        {
+            suballocation = suballocateMemory(memoryType, requirements.memory, tiling);
+        }
     }
 
     if (!suballocation)
     {
-        throw std::runtime_error("Could not allocate memory.");
+        return std::nullopt;
     }
 
+    _requestedSize += suballocation->size;
+    _roundedSize += legacyRoundedSize(suballocation->size);
+
     spdlog::trace("Suballocated {}KB.", suballocation->size / 1000);
 
-    return *suballocation;
+    return suballocation;
+}
+
+DeviceAllocator::MemoryPreference DeviceAllocator::memoryPreference(MemoryUsage usage)
+{
+    switch (usage)
+    {
+        case MemoryUsage::GpuOnly:
+            return {.preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, .avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT};
+        case MemoryUsage::Upload:
+            // Leave the small device-local host-visible heap to streaming data.
+            return {.required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, .preferred = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    .avoided = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT};
+        case MemoryUsage::Readback:
+            return {.required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                    .preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
+        case MemoryUsage::Streaming:
+            return {.required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                    .preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    .avoided = VK_MEMORY_PROPERTY_HOST_CACHED_BIT};
+    }
+
+    throw std::runtime_error("Unknown memory usage.");
 }
 
-DeviceAllocator::MemorySection DeviceAllocator::findMemoryType(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties)
+std::vector<DeviceAllocator::MemorySection> DeviceAllocator::findMemoryTypes(uint32 memoryTypeBits, MemoryUsage usage) const
 {
-    VkPhysicalDeviceMemoryProperties const memories = _device->memories();
+    MemoryPreference const preference = memoryPreference(usage);
+
+    // A preferred flag outweighs any number of avoided ones, device local being the most important.
+    auto score = [&preference](VkMemoryPropertyFlags flags)
+    {
+        int32 const preferred = std::popcount(flags & preference.preferred) * 4 +
+                                ((flags & preference.preferred & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? 4 : 0);
+        int32 const avoided = std::popcount(flags & preference.avoided);
+
+        return preferred - avoided;
+    };
 
-    for (uint32_t i = 0; i < memories.memoryTypeCount; ++i)
+    std::vector<std::pair<int32, MemorySection>> candidates;
+    for (uint32 i = 0; i < _memories.memoryTypeCount; ++i)
     {
-        if ((requirements.memoryTypeBits & (1u << i)) && (memories.memoryTypes[i].propertyFlags & properties) == properties)
+        VkMemoryPropertyFlags const flags = _memories.memoryTypes[i].propertyFlags;
+        if ((memoryTypeBits & (1u << i)) && (flags & preference.required) == preference.required)
         {
-            return {i, memories.memoryTypes[i].heapIndex};
+            candidates.emplace_back(score(flags), MemorySection {i, _memories.memoryTypes[i].heapIndex});
         }
     }
 
-    throw std::runtime_error("failed to find suitable memory type!");
+    if (candidates.empty())
+    {
+        throw std::runtime_error("failed to find suitable memory type!");
+    }
+
+    // Ties keep the driver order, which ranks types by performance.
+    std::stable_sort(candidates.begin(), candidates.end(), [](auto const &a, auto const &b)
+    {
+        return a.first > b.first;
+    });
+
+    std::vector<MemorySection> memoryTypes;
+    memoryTypes.reserve(candidates.size());
+    for (auto const &[score, memoryType] : candidates)
+    {
+        memoryTypes.push_back(memoryType);
+    }
+
+    return memoryTypes;
 }
 
-void DeviceAllocator::allocateMemory(MemorySection section)
+bool DeviceAllocator::allocateMemory(MemorySection section, Tiling tiling, VkMemoryRequirements requirements)
 {
+    Heap &heap = _heaps[std::get<1>(section)];
+
+    // Grow geometrically with the number of blocks this memory type already has.
+    auto const blockCount = static_cast<uint32>(std::count_if(heap.allocations.begin(), heap.allocations.end(), [section](auto const &allocation)
+    {
+        return allocation->memoryType == std::get<0>(section);
+    }));
+    VkDeviceSize size = heap.maxAllocationSize >> (allocationGrowthSteps - std::min(blockCount, allocationGrowthSteps));
+
+    // The block must hold the request whatever the alignment padding is.
+    while (size < requirements.size + requirements.alignment - 1)
+    {
+        size *= 2;
+    }
+
+    if (!isWithinBudget(std::get<1>(section), size))
+    {
+        return false;
+    }
+
     VkMemoryAllocateInfo allocateInfo
     {
         .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = allocationSize,
+        .allocationSize = size,
         .memoryTypeIndex = std::get<0>(section),
     };
 
     VkDeviceMemory memory = VK_NULL_HANDLE;
-    ThrowError(vkAllocateMemory(*_device, &allocateInfo, nullptr, &memory));
+    if (VkResult result = vkAllocateMemory(*_device, &allocateInfo, nullptr, &memory); result == VK_ERROR_OUT_OF_DEVICE_MEMORY)
+    {
+        return false;
+    }
+    else
+    {
+        ThrowError(result);
+    }
 
-    _heaps[std::get<1>(section)].allocatedSize += allocationSize;
+    heap.allocatedSize += size;
 
-    Allocation allocation
+    heap.allocations.push_back(std::make_unique<Allocation>(Allocation
     {
         .memory = memory,
-        .size = allocationSize,
+        .size = size,
+        .mapped = mapMemory(memory, std::get<0>(section)),
         .memoryType = std::get<0>(section),
-    };
-    _heaps[std::get<1>(section)].allocations.push_back(std::move(allocation));
+        .tiling = tiling,
+        .blocks = Tlsf::create(size),
+    }));
+
+    spdlog::debug("Allocated {}MB (total: {}MB).", size / 1000000, allocatedSizeLocked() / 1000000);
 
-    spdlog::debug("Allocated {}MB (total: {}MB).", allocationSize / 1000000, totalDeviceAllocation() / 1000000);
+    return true;
 }
 
-static VkDeviceSize nextPowerOfTwo(VkDeviceSize size)
+void DeviceAllocator::releaseEmptyAllocation(HeapIndex heapIndex, Allocation const *empty)
 {
-    --size;
-    size |= size >> 1u;
-    size |= size >> 2u;
-    size |= size >> 4u;
-    size |= size >> 8u;
-    size |= size >> 16u;
-    size |= size >> 32u;
-    ++size;
+    Heap &heap = _heaps[heapIndex];
+
+    // Keep one empty block per memory type, so a resource created and destroyed every frame doesn't allocate and
+    // free a whole block every frame.
+    bool const hasSpare = std::any_of(heap.allocations.begin(), heap.allocations.end(), [empty](auto const &allocation)
+    {
+        return allocation.get() != empty && allocation->memoryType == empty->memoryType && allocation->blocks.empty();
+    });
+
+    if (!hasSpare)
+    {
+        return;
+    }
+
+    VkDeviceSize const size = empty->size;
+    vkFreeMemory(*_device, empty->memory, nullptr);
+    heap.allocatedSize -= size;
+    std::erase_if(heap.allocations, [empty](auto const &allocation)
+    {
+        return allocation.get() == empty;
+    });
+
+    spdlog::debug("Released empty {}MB (total: {}MB).", size / 1000000, allocatedSizeLocked() / 1000000);
+}
+
+std::optional<DeviceAllocator::ResourceMemory> DeviceAllocator::allocateDedicatedMemory(MemorySection section, Tiling tiling,
+                                                                                        VkMemoryRequirements requirements,
+                                                                                        VkBuffer buffer, VkImage image)
+{
+    // The dedicated info may only be chained when the extension is enabled.
+    VkMemoryDedicatedAllocateInfoKHR dedicatedInfo
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR,
+        .image = image,
+        .buffer = buffer,
+    };
+    bool const useDedicatedInfo = _getBufferMemoryRequirements2 && (buffer != VK_NULL_HANDLE || image != VK_NULL_HANDLE);
+
+    if (!isWithinBudget(std::get<1>(section), requirements.size))
+    {
+        return std::nullopt;
+    }
 
-    return size;
+    VkMemoryAllocateInfo allocateInfo
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = useDedicatedInfo ? &dedicatedInfo : nullptr,
+        .allocationSize = requirements.size,
+        .memoryTypeIndex = std::get<0>(section),
+    };
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    if (VkResult result = vkAllocateMemory(*_device, &allocateInfo, nullptr, &memory); result == VK_ERROR_OUT_OF_DEVICE_MEMORY)
+    {
+        return std::nullopt;
+    }
+    else
+    {
+        ThrowError(result);
+    }
+
+    Heap &heap = _heaps[std::get<1>(section)];
+    heap.allocatedSize += requirements.size;
+    heap.dedicatedAllocations.insert({memory, {requirements.size, std::get<0>(section)}});
+
+    spdlog::debug("Allocated dedicated {}MB (total: {}MB).", requirements.size / 1000000, allocatedSizeLocked() / 1000000);
+
+    return ResourceMemory(memory, 0, requirements.size, mapMemory(memory, std::get<0>(section)), std::get<1>(section),
+                          std::get<0>(section), tiling, true);
 }
 
-std::optional<DeviceAllocator::ResourceMemory> DeviceAllocator::suballocateMemory(MemorySection section, VkMemoryRequirements requirements)
+std::optional<DeviceAllocator::ResourceMemory> DeviceAllocator::suballocateMemory(MemorySection section, VkMemoryRequirements requirements, Tiling tiling)
 {
     HeapIndex heapIndex = std::get<1>(section);
     Heap &heap = _heaps[heapIndex];
-    VkDeviceSize size = std::max(nextPowerOfTwo(requirements.size), uint64 {256u});
 
-    for (auto &allocation : heap.allocations)
+    // With a granularity of one, linear and optimal resources can be neighbours.
+    bool const separateTilings = _bufferImageGranularity > 1;
+
+    for (auto const &allocation : heap.allocations)
     {
-        VkDeviceSize previousEnd = 0;
+        if (allocation->memoryType != std::get<0>(section))
+        {
+            continue;
+        }
 
-        if (allocation.memoryType != std::get<0>(section))
+        if (separateTilings && allocation->tiling != tiling)
         {
             continue;
         }
 
-        for (auto const &resource : allocation.resources)
+        if (auto resourceMemory = suballocateInAllocation(heapIndex, *allocation, requirements, tiling))
         {
-            VkDeviceSize begin = resource.first;
-            VkDeviceSize end = resource.first + resource.second;
+            return resourceMemory;
+        }
+    }
+
+    return std::nullopt;
+}
+
+std::optional<DeviceAllocator::ResourceMemory> DeviceAllocator::suballocateInAllocation(HeapIndex heapIndex, Allocation &allocation,
+                                                                                        VkMemoryRequirements requirements, Tiling tiling)
+{
+    VkDeviceSize size = requirements.size;
+
+    Tlsf::Node *node = allocation.blocks.allocate(size, requirements.alignment);
+    if (!node)
+    {
+        return std::nullopt;
+    }
+
+    std::byte *mapped = allocation.mapped ? allocation.mapped + node->offset : nullptr;
+    ResourceMemory resourceMemory = {allocation.memory, node->offset, size, mapped, heapIndex, allocation.memoryType,
+                                     tiling, false};
+    resourceMemory._allocation = &allocation;
+    resourceMemory._node = node;
+    allocation.resources.insert({node->offset, {.node = node, .alignment = requirements.alignment}});
+    allocation.subAllocatedSize += size;
+    return resourceMemory;
+}
+
+void DeviceAllocator::setRelocatable(ResourceMemory const &resource, Relocatable *owner)
+{
+    if (resource._dedicated)
+    {
+        return;
+    }
+
+    std::lock_guard lock(*_mutex);
 
-            if (begin - previousEnd >= size)
+    auto suballocation = resource._allocation->resources.find(resource.offset);
+    if (suballocation == resource._allocation->resources.end())
+    {
+        throw std::runtime_error("Tried to relocate unknown resource.");
+    }
+
+    suballocation->second.owner = owner;
+}
+
+std::vector<DeviceAllocator::Relocation> DeviceAllocator::planDefragmentation(VkDeviceSize byteBudget)
+{
+    std::lock_guard lock(*_mutex);
+
+    // Cached ranges would pin their blocks.
+    drainThreadCaches();
+
+    std::vector<Relocation> relocations;
+    VkDeviceSize plannedSize = 0;
+    bool const separateTilings = _bufferImageGranularity > 1;
+
+    for (HeapIndex heapIndex = 0; heapIndex < _heaps.size(); ++heapIndex)
+    {
+        // Densest blocks first. Resources only move toward the front, so successive passes converge.
+        std::vector<Allocation *> blocks;
+        for (auto const &allocation : _heaps[heapIndex].allocations)
+        {
+            if (!allocation->resources.empty())
             {
-                ResourceMemory resourceMemory = {allocation.memory, previousEnd, size, heapIndex};
-                allocation.resources.insert({previousEnd, size});
-                allocation.subAllocatedSize += size;
-                return resourceMemory;
+                blocks.push_back(allocation.get());
             }
-
-            previousEnd = end;
         }
 
-        if (allocation.size - previousEnd >= size)
+        std::sort(blocks.begin(), blocks.end(), [](Allocation const *a, Allocation const *b)
         {
-            ResourceMemory resourceMemory = {allocation.memory, previousEnd, size, heapIndex};
-            allocation.resources.insert({previousEnd, size});
-            allocation.subAllocatedSize += size;
-            return resourceMemory;
+            return a->subAllocatedSize * b->size > b->subAllocatedSize * a->size;
+        });
+
+        // Blocks receiving resources during this pass can't give theirs away, they would move twice.
+        std::vector<Allocation const *> receivers;
+
+        for (auto source = blocks.rbegin(); source != blocks.rend(); ++source)
+        {
+            Allocation &sourceBlock = **source;
+
+            // A single pinned resource keeps the block alive: moving the others wouldn't free anything.
+            bool const isMovable = std::all_of(sourceBlock.resources.begin(), sourceBlock.resources.end(), [](auto const &resource)
+            {
+                return resource.second.owner != nullptr;
+            });
+
+            if (!isMovable || std::find(receivers.begin(), receivers.end(), &sourceBlock) != receivers.end())
+            {
+                continue;
+            }
+
+            // Moves out of one block may span several steps: once some resources left, the block is sparser and comes
+            // first again at the next step. Until then, the resources moved don't release anything.
+            usize const firstMove = relocations.size();
+            VkDeviceSize const previouslyPlannedSize = plannedSize;
+
+            for (auto const &[offset, suballocation] : sourceBlock.resources)
+            {
+                VkDeviceSize const size = suballocation.node->size;
+
+                // A resource bigger than the whole budget still moves, alone, or its block could never be emptied.
+                if (plannedSize + size > byteBudget && !relocations.empty())
+                {
+                    return relocations;
+                }
+
+                std::optional<ResourceMemory> destination;
+                for (auto target = blocks.begin(); !destination && *target != &sourceBlock; ++target)
+                {
+                    Allocation &targetBlock = **target;
+                    if (targetBlock.memoryType != sourceBlock.memoryType || (separateTilings && targetBlock.tiling != sourceBlock.tiling))
+                    {
+                        continue;
+                    }
+
+                    destination = suballocateInAllocation(heapIndex, targetBlock, {.size = size, .alignment = suballocation.alignment},
+                                                          sourceBlock.tiling);
+                    if (destination)
+                    {
+                        targetBlock.resources.at(destination->offset).owner = suballocation.owner;
+                        receivers.push_back(&targetBlock);
+                    }
+                }
+
+                // No room in denser blocks for this one, the source block can't be emptied: the moves already planned
+                // out of it are given up, and the budget goes to the next block.
+                if (!destination)
+                {
+                    for (auto move = relocations.begin() + static_cast<std::ptrdiff_t>(firstMove); move != relocations.end(); ++move)
+                    {
+                        move->destination._allocation->resources.at(move->destination.offset).owner = nullptr;
+                        freeLocked(move->destination);
+                    }
+                    relocations.erase(relocations.begin() + static_cast<std::ptrdiff_t>(firstMove), relocations.end());
+                    plannedSize = previouslyPlannedSize;
+                    break;
+                }
+
+                std::byte *mapped = sourceBlock.mapped ? sourceBlock.mapped + offset : nullptr;
+                ResourceMemory source = {sourceBlock.memory, offset, size, mapped, heapIndex, sourceBlock.memoryType,
+                                         sourceBlock.tiling, false};
+                source._allocation = &sourceBlock;
+                source._node = suballocation.node;
+
+                _requestedSize += size;
+                _roundedSize += legacyRoundedSize(size);
+                plannedSize += size;
+                relocations.push_back({suballocation.owner, source, *destination});
+            }
         }
     }
 
-    return std::nullopt;
+    return relocations;
+}
+
+void DeviceAllocator::trim()
+{
+    std::lock_guard lock(*_mutex);
+
+    drainThreadCaches();
+}
+
+std::byte *DeviceAllocator::mapMemory(VkDeviceMemory memory, uint32 memoryType)
+{
+    if (!(_memories.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+    {
+        return nullptr;
+    }
+
+    void *data = nullptr;
+    ThrowError(vkMapMemory(*_device, memory, 0, VK_WHOLE_SIZE, 0, &data));
+
+    return static_cast<std::byte *>(data);
+}
+
+bool DeviceAllocator::isCoherent(uint32 memoryType) const
+{
+    VkMemoryPropertyFlags const flags = _memories.memoryTypes[memoryType].propertyFlags;
+
+    return !(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) || (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+std::optional<VkMappedMemoryRange> DeviceAllocator::nonCoherentRange(ResourceMemory const &resource, VkDeviceSize offset,
+                                                                     VkDeviceSize size) const
+{
+    if (isCoherent(resource._memoryType) || offset >= resource.size)
+    {
+        return std::nullopt;
+    }
+
+    // Resources start and end on atom boundaries, so the rounded range stays inside the resource.
+    size = std::min(size, resource.size - offset);
+    VkDeviceSize const begin = (resource.offset + offset) / _nonCoherentAtomSize * _nonCoherentAtomSize;
+    VkDeviceSize const end = (resource.offset + offset + size + _nonCoherentAtomSize - 1) / _nonCoherentAtomSize * _nonCoherentAtomSize;
+
+    return VkMappedMemoryRange
+    {
+        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        .memory = resource.memory,
+        .offset = begin,
+        .size = end - begin,
+    };
 }
 
 usize DeviceAllocator::totalDeviceAllocation() const
+{
+    std::lock_guard lock(*_mutex);
+
+    return allocatedSizeLocked();
+}
+
+usize DeviceAllocator::allocatedSizeLocked() const
 {
     usize total = 0;
     for (auto const &heap : _heaps)
@@ -209,7 +789,279 @@ usize DeviceAllocator::totalDeviceAllocation() const
     return total;
 }
 
+void DeviceAllocator::logReport() const
+{
+    std::lock_guard lock(*_mutex);
+
+    spdlog::info("Device allocator report:");
+
+    for (usize heapIndex = 0; heapIndex < _heaps.size(); ++heapIndex)
+    {
+        for (auto const &allocation : _heaps[heapIndex].allocations)
+        {
+            spdlog::info("    Heap: {}, Type: {}, {}: {} resources, {}KB used, {}KB free.", heapIndex,
+                         allocation->memoryType, allocation->tiling == Tiling::Linear ? "linear" : "optimal",
+                         allocation->resources.size(), allocation->subAllocatedSize / 1000,
+                         allocation->blocks.freeSize() / 1000);
+        }
+
+        for (auto const &[memory, dedicated] : _heaps[heapIndex].dedicatedAllocations)
+        {
+            spdlog::info("    Heap: {}, Type: {}, Dedicated: {}KB used.", heapIndex, dedicated.memoryType, dedicated.size / 1000);
+        }
+    }
+
+    spdlog::info("    Requested: {}KB. Power-of-two rounding would use {}KB, wasting {}KB.", _requestedSize / 1000,
+                 _roundedSize / 1000, (_roundedSize - _requestedSize) / 1000);
+}
+
+DeviceAllocator::Statistics DeviceAllocator::statistics() const
+{
+    std::lock_guard lock(*_mutex);
+
+    Statistics statistics
+    {
+        .heaps = std::vector<HeapStatistics>(_heaps.size()),
+        .memoryTypes = std::vector<Usage>(_memories.memoryTypeCount),
+    };
+
+    auto const budget = _device->memoryBudget();
+    statistics.hasDriverBudget = budget.has_value();
+
+    auto addResource = [](Usage &usage, VkDeviceSize size)
+    {
+        ++usage.resourceCount;
+        usage.usedSize += size;
+        // Empty resources have no bucket.
+        if (size != 0)
+        {
+            ++usage.sizeHistogram[std::bit_width(size) - 1];
+        }
+    };
+
+    for (usize heapIndex = 0; heapIndex < _heaps.size(); ++heapIndex)
+    {
+        Heap const &heap = _heaps[heapIndex];
+        HeapStatistics &heapStatistics = statistics.heaps[heapIndex];
+
+        heapStatistics.size = heap.size;
+        heapStatistics.budget = budget ? budget->heapBudget[heapIndex] : heap.size * fallbackBudgetPercent / 100;
+        heapStatistics.processUsage = budget ? budget->heapUsage[heapIndex] : heap.allocatedSize;
+
+        for (auto const &allocation : heap.allocations)
+        {
+            for (Usage *usage : {&heapStatistics.usage, &statistics.memoryTypes[allocation->memoryType]})
+            {
+                ++usage->blockCount;
+                usage->allocatedSize += allocation->size;
+                usage->freeSize += allocation->blocks.freeSize();
+                usage->largestFreeRange = std::max(usage->largestFreeRange, allocation->blocks.largestFreeSize());
+
+                for (auto const &[offset, suballocation] : allocation->resources)
+                {
+                    addResource(*usage, suballocation.node->size);
+                }
+            }
+        }
+
+        for (auto const &[memory, dedicated] : heap.dedicatedAllocations)
+        {
+            for (Usage *usage : {&heapStatistics.usage, &statistics.memoryTypes[dedicated.memoryType]})
+            {
+                ++usage->dedicatedCount;
+                usage->allocatedSize += dedicated.size;
+                addResource(*usage, dedicated.size);
+            }
+        }
+    }
+
+    return statistics;
+}
+
+std::string DeviceAllocator::statisticsJson() const
+{
+    Statistics const statistics = this->statistics();
+    std::string json;
+    auto out = std::back_inserter(json);
+
+    auto writeUsage = [&out](Usage const &usage)
+    {
+        // Trailing empty buckets are left out.
+        auto const last = std::find_if(usage.sizeHistogram.rbegin(), usage.sizeHistogram.rend(), [](uint32 count)
+        {
+            return count != 0;
+        });
+        auto const histogramSize = static_cast<usize>(usage.sizeHistogram.rend() - last);
+
+        fmt::format_to(out, R"("blockCount":{},"dedicatedCount":{},"resourceCount":{},"allocatedBytes":{},)"
+                            R"("usedBytes":{},"freeBytes":{},"largestFreeRange":{},"sizeHistogramLog2":[{}])",
+                       usage.blockCount, usage.dedicatedCount, usage.resourceCount, usage.allocatedSize, usage.usedSize,
+                       usage.freeSize, usage.largestFreeRange,
+                       fmt::join(usage.sizeHistogram.begin(), usage.sizeHistogram.begin() + histogramSize, ","));
+    };
+
+    fmt::format_to(out, R"({{"driverBudget":{},"heaps":[)", statistics.hasDriverBudget);
+    for (usize i = 0; i < statistics.heaps.size(); ++i)
+    {
+        HeapStatistics const &heap = statistics.heaps[i];
+        fmt::format_to(out, R"({}{{"index":{},"size":{},"budget":{},"processUsage":{},)", i ? "," : "", i, heap.size,
+                       heap.budget, heap.processUsage);
+        writeUsage(heap.usage);
+        json += '}';
+    }
+
+    json += R"(],"memoryTypes":[)";
+    for (usize i = 0; i < statistics.memoryTypes.size(); ++i)
+    {
+        fmt::format_to(out, R"({}{{"index":{},"heap":{},"flags":{},)", i ? "," : "", i, _memories.memoryTypes[i].heapIndex,
+                       _memories.memoryTypes[i].propertyFlags);
+        writeUsage(statistics.memoryTypes[i]);
+        json += '}';
+    }
+    json += "]}";
+
+    return json;
+}
+
+uint64 DeviceAllocator::cacheKey(uint32 memoryType, Tiling tiling, VkDeviceSize size)
+{
+    return (size / smallSizeGranularity) << 32u | static_cast<uint64>(tiling) << 16u | memoryType;
+}
+
+DeviceAllocator::ThreadCache &DeviceAllocator::threadCache()
+{
+    // map<allocator id, cache>. Caches of destroyed allocators have been drained, their ids are never used again.
+    thread_local std::unordered_map<uint64, std::shared_ptr<ThreadCache>> caches;
+
+    auto &cache = caches[_id];
+    if (!cache)
+    {
+        cache = std::make_shared<ThreadCache>();
+
+        std::lock_guard lock(*_mutex);
+        _threadCaches.push_back(cache);
+    }
+
+    return *cache;
+}
+
+std::optional<DeviceAllocator::ResourceMemory> DeviceAllocator::takeFromThreadCache(uint32 memoryType, Tiling tiling,
+                                                                                    VkMemoryRequirements requirements)
+{
+    std::optional<ResourceMemory> memory;
+
+    {
+        ThreadCache &cache = threadCache();
+        std::lock_guard lock(cache.mutex);
+
+        auto freeList = cache.freeLists.find(cacheKey(memoryType, tiling, requirements.size));
+        if (freeList == cache.freeLists.end())
+        {
+            return std::nullopt;
+        }
+
+        auto &resources = freeList->second;
+        auto resource = std::find_if(resources.rbegin(), resources.rend(), [&requirements](ResourceMemory const &resource)
+        {
+            return resource.offset % requirements.alignment == 0;
+        });
+
+        if (resource == resources.rend())
+        {
+            return std::nullopt;
+        }
+
+        memory = *resource;
+        resources.erase(std::next(resource).base());
+        cache.cachedSize -= memory->size;
+    }
+
+    // Cached ranges keep their suballocation, and with it the owner of the freed resource: the new one must opt in
+    // again. Lock order is allocator then cache, so only once the cache is released.
+    std::lock_guard lock(*_mutex);
+    assertExclusive(*memory);
+    memory->_allocation->resources.at(memory->offset).owner = nullptr;
+
+    return memory;
+}
+
+bool DeviceAllocator::giveToThreadCache(ResourceMemory const &resource)
+{
+    if (resource._dedicated || resource.size > smallSizeThreshold)
+    {
+        return false;
+    }
+
+    ThreadCache &cache = threadCache();
+    std::lock_guard lock(cache.mutex);
+
+    if (cache.cachedSize + resource.size > threadCacheSize)
+    {
+        return false;
+    }
+
+    auto &resources = cache.freeLists[cacheKey(resource._memoryType, resource._tiling, resource.size)];
+    assert(std::none_of(resources.begin(), resources.end(), [&resource](ResourceMemory const &cached)
+    {
+        return cached._node == resource._node;
+    }) && "Suballocation freed twice.");
+    resources.push_back(resource);
+    cache.cachedSize += resource.size;
+
+    return true;
+}
+
+void DeviceAllocator::drainThreadCaches()
+{
+    for (auto const &cache : _threadCaches)
+    {
+        std::lock_guard lock(cache->mutex);
+
+        for (auto const &[key, resources] : cache->freeLists)
+        {
+            for (auto const &resource : resources)
+            {
+                freeLocked(resource);
+            }
+        }
+
+        cache->freeLists.clear();
+        cache->cachedSize = 0;
+    }
+
+    // Only the allocator still references the caches of exited threads.
+    std::erase_if(_threadCaches, [](std::shared_ptr<ThreadCache> const &cache)
+    {
+        return cache.use_count() == 1;
+    });
+}
+
+bool DeviceAllocator::isWithinBudget(HeapIndex heapIndex, VkDeviceSize size) const
+{
+    VkDeviceSize budget = _heaps[heapIndex].size * fallbackBudgetPercent / 100;
+    VkDeviceSize usage = _heaps[heapIndex].allocatedSize;
+
+    if (auto const memoryBudget = _device->memoryBudget())
+    {
+        budget = memoryBudget->heapBudget[heapIndex];
+        usage = memoryBudget->heapUsage[heapIndex];
+    }
+
+    if (usage + size > budget)
+    {
+        spdlog::warn("Heap {} budget exceeded: {}MB used, {}MB requested, {}MB budget.", heapIndex, usage / 1000000,
+                     size / 1000000, budget / 1000000);
+        return false;
+    }
+
+    return true;
+}
+
 DeviceAllocator::ResourceMemory::ResourceMemory(not_null<VkDeviceMemory> memory, VkDeviceSize offset, VkDeviceSize size,
-                                                usize heap) :
-                                                memory(memory), offset(offset), size(size), _heap(heap)
+                                                std::byte *mapped, usize heap, uint32 memoryType, Tiling tiling,
+                                                bool dedicated) :
+                                                memory(memory), offset(offset), size(size),
+                                                mapped(mapped ? std::span<std::byte>(mapped, size) : std::span<std::byte>()),
+                                                _heap(heap), _memoryType(memoryType), _tiling(tiling),
+                                                _dedicated(dedicated)
 {}
@@ -1,12 +1,18 @@
 #ifndef VULKAN_ENGINE_DEVICEALLOCATOR_H
 #define VULKAN_ENGINE_DEVICEALLOCATOR_H
 
+#include <array>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
 #include <vector>
-#include <map>
+#include <unordered_map>
 #include <tuple>
 #include <optional>
 
 #include "vulkan.h"
+#include "tlsf.h"
 
 namespace Engine::Vulkan
 {
@@ -15,13 +21,101 @@ class LogicalDevice;
 /**
  * This class allow you to automatically allocate usable chunk memories.
  *
- * It manages big-allocation to create sub-allocations.
+ * It manages big-allocation to create sub-allocations. Each big-allocation is split by a TLSF block manager, so
+ * sub-allocating and freeing don't depend on the number of live resources.
  *
- * Each suballocation size you request will be rounded to the nearest superior or equal power of two.
+ * Suballocations have the exact size and alignment given by `VkMemoryRequirements`. When the device reports a
+ * `bufferImageGranularity` greater than one, linear resources (buffers, linear images) and optimal images never
+ * share the same big-allocation, so they can't end up on the same granularity page.
+ *
+ * Big-allocations start small and grow geometrically with the number of blocks of a memory type, up to
+ * `maxAllocationSize` or a fraction of the heap size on small heaps. Empty big-allocations are given back to the
+ * driver, except one per memory type which is kept around to avoid thrashing `vkAllocateMemory`.
+ *
+ * Resources larger than half a block, or for which the driver asks for it through `VK_KHR_dedicated_allocation`,
+ * get their own `VkDeviceMemory` instead of a suballocation.
+ *
+ * Host-visible memory is mapped once, when it is allocated, and stays mapped until it is freed. Suballocations in
+ * non-coherent memory are aligned to `nonCoherentAtomSize` so flushing or invalidating one never touches another.
+ *
+ * Resources ask for a `MemoryUsage` rather than property flags. Every memory type compatible with the resource is
+ * scored against that usage, and tried from the best to the worst one.
+ *
+ * New device memory is only allocated while the heap stays within its budget, given by `VK_EXT_memory_budget` when
+ * available, or a fixed fraction of the heap otherwise. Past that point the next memory type is tried, and the
+ * allocation throws once none is left, instead of letting the driver silently page the heap out to system memory.
+ *
+ * Every public member function may be called concurrently. Small suballocations are rounded to
+ * `smallSizeGranularity` and, when freed, kept in a free list local to the freeing thread, so that thread can reuse
+ * them without taking the allocator lock. Those lists are drained back to the blocks before any new block is
+ * allocated.
+ *
+ * Owners may let their resources be moved by `Defragmenter`, see `setRelocatable()`. Resources are then moved out
+ * of the sparsest blocks into the free ranges of denser ones, so the emptied blocks can be released.
  */
 class DeviceAllocator : public OnlyMovable
 {
+    struct Allocation;
+
 public:
+    /**
+     * Which side of `bufferImageGranularity` a resource is on.
+     */
+    enum class Tiling
+    {
+        Linear,
+        Optimal,
+    };
+
+    /**
+     * Occupancy of a set of big-allocations and dedicated allocations.
+     */
+    struct Usage
+    {
+        uint32 blockCount = 0;
+        uint32 dedicatedCount = 0;
+        uint32 resourceCount = 0;
+        // Bytes of device memory, bytes handed out to resources, and bytes still free inside blocks.
+        VkDeviceSize allocatedSize = 0;
+        VkDeviceSize usedSize = 0;
+        VkDeviceSize freeSize = 0;
+        VkDeviceSize largestFreeRange = 0;
+        // sizeHistogram[i] counts the resources whose size is in [2^i, 2^(i+1)).
+        std::array<uint32, 64> sizeHistogram {};
+    };
+
+    struct HeapStatistics
+    {
+        VkDeviceSize size = 0;
+        // Budget and usage of the whole process, as reported by the driver, or estimated from our own allocations.
+        VkDeviceSize budget = 0;
+        VkDeviceSize processUsage = 0;
+        Usage usage;
+    };
+
+    struct Statistics
+    {
+        // Whether budget and usage come from `VK_EXT_memory_budget`.
+        bool hasDriverBudget = false;
+        std::vector<HeapStatistics> heaps;
+        std::vector<Usage> memoryTypes;
+    };
+
+    /**
+     * What the host and the device do with a resource, which drives the memory type choice.
+     */
+    enum class MemoryUsage
+    {
+        // Only accessed by the device: textures, vertex buffers, render targets.
+        GpuOnly,
+        // Written once by the host, then copied by the device: staging buffers.
+        Upload,
+        // Written by the device, read by the host.
+        Readback,
+        // Rewritten by the host every frame and read by the device: uniforms, dynamic geometry.
+        Streaming,
+    };
+
     struct ResourceMemory
     {
         friend DeviceAllocator;
@@ -29,11 +123,68 @@ public:
         not_null<VkDeviceMemory> memory;
         VkDeviceSize offset;
         VkDeviceSize size;
+        // Host address of this resource memory. Empty if the memory isn't host visible.
+        std::span<std::byte> mapped;
+
+        /**
+         * Index of the memory type, to be checked against `VkMemoryRequirements::memoryTypeBits`.
+         */
+        [[nodiscard]] uint32 memoryType() const
+        {
+            return _memoryType;
+        }
 
     private:
-        ResourceMemory(not_null<VkDeviceMemory> memory, VkDeviceSize offset, VkDeviceSize size, usize heap);
+        ResourceMemory(not_null<VkDeviceMemory> memory, VkDeviceSize offset, VkDeviceSize size, std::byte *mapped,
+                       usize heap, uint32 memoryType, Tiling tiling, bool dedicated);
 
         usize _heap;
+        uint32 _memoryType;
+        Tiling _tiling;
+        bool _dedicated;
+        // Where the suballocation lives, so freeing it doesn't search. Null for dedicated allocations.
+        Allocation *_allocation = nullptr;
+        Tlsf::Node *_node = nullptr;
+    };
+
+    /**
+     * Implemented by owners of resources the defragmenter may move, see `setRelocatable()`.
+     */
+    class Relocatable
+    {
+    public:
+        virtual ~Relocatable() = default;
+
+        /**
+         * Create a new resource bound to `destination`, without recording anything yet.
+         *
+         * @return `false` if the resource can't be moved there, in which case nothing must have been kept. The
+         *         defragmenter then pins the resource, see `setRelocatable()`.
+         */
+        virtual bool prepareRelocation(ResourceMemory const &destination) = 0;
+        /**
+         * Record into `commandBuffer` the copy of the current content into the prepared resource. The command buffer
+         * is submitted once every relocation of the pass is recorded.
+         */
+        virtual void recordRelocation(VkCommandBuffer commandBuffer) = 0;
+        /**
+         * The move was given up before being recorded: destroy the prepared resource. Its destination is freed by the
+         * caller.
+         */
+        virtual void cancelRelocation() = 0;
+        /**
+         * The copy completed and the device is idle: switch to the new resource, destroy the old one and free its
+         * memory.
+         */
+        virtual void completeRelocation() = 0;
+    };
+
+    struct Relocation
+    {
+        Relocatable *owner;
+        // Where the resource is now. Moves sharing `source.memory` empty the same block.
+        ResourceMemory source;
+        ResourceMemory destination;
     };
 
     [[nodiscard]] static DeviceAllocator create(not_null<LogicalDevice*> device);
@@ -42,47 +193,220 @@ public:
     DeviceAllocator(DeviceAllocator &&) = default;
     DeviceAllocator &operator=(DeviceAllocator &&) = default;
 
-    [[nodiscard]] ResourceMemory allocate(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties);
+    [[nodiscard]] ResourceMemory allocate(VkMemoryRequirements requirements, MemoryUsage usage, Tiling tiling);
+    /**
+     * Query the memory requirements of `buffer` and allocate memory for it. The memory isn't bound.
+     *
+     * Prefer these over `allocate()`: they let the driver request a dedicated allocation.
+     */
+    [[nodiscard]] ResourceMemory allocateForBuffer(VkBuffer buffer, MemoryUsage usage);
+    [[nodiscard]] ResourceMemory allocateForImage(VkImage image, MemoryUsage usage, Tiling tiling);
     void free(ResourceMemory const &resource);
 
+    /**
+     * Make host writes to `[offset, offset + size)` of `resource` visible to the device.
+     * Offsets are relative to the resource. Does nothing on host coherent memory.
+     */
+    void flush(ResourceMemory const &resource, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+    /**
+     * Make device writes to `[offset, offset + size)` of `resource` visible to the host.
+     * Offsets are relative to the resource. Does nothing on host coherent memory.
+     */
+    void invalidate(ResourceMemory const &resource, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+
+    /**
+     * Let the defragmenter move `resource` by calling `owner` back, or pin it again with `nullptr`.
+     * Only the pointer is kept: owners must call it again when they are moved themselves.
+     * Dedicated allocations are never moved.
+     */
+    void setRelocatable(ResourceMemory const &resource, Relocatable *owner);
+    /**
+     * Reserve destinations for at most `byteBudget` bytes of relocatable resources, out of the sparsest blocks and
+     * into denser blocks of the same memory type. No block is allocated for that.
+     *
+     * A block whose resources don't fit in the budget is emptied over several calls. Blocks which can't be emptied
+     * are skipped. A single resource bigger than the budget is still planned, alone.
+     *
+     * A destination is registered to the same owner as its source. Each relocation must end with either
+     * `Relocatable::completeRelocation()` or the destination being freed.
+     */
+    [[nodiscard]] std::vector<Relocation> planDefragmentation(VkDeviceSize byteBudget);
+    /**
+     * Give the ranges cached by threads back to their blocks, and release the blocks emptied that way.
+     */
+    void trim();
+
     [[nodiscard]] usize totalDeviceAllocation() const;
 
+    /**
+     * Log, for every big-allocation, how many bytes are used and free. It also logs how many bytes the previous
+     * power-of-two rounding would have consumed for the same live resources, to keep an eye on the savings.
+     */
+    void logReport() const;
+
+    [[nodiscard]] Statistics statistics() const;
+    /**
+     * `statistics()` as a JSON document, for tools to scrape.
+     */
+    [[nodiscard]] std::string statisticsJson() const;
+
 private:
+    struct Suballocation
+    {
+        Tlsf::Node *node;
+        // Needed to find a destination when defragmenting.
+        VkDeviceSize alignment;
+        Relocatable *owner = nullptr;
+    };
+
     struct Allocation
     {
         VkHandle<VkDeviceMemory> memory;
         VkDeviceSize size;
+        // Start of the persistent mapping, `nullptr` if the memory isn't host visible.
+        std::byte *mapped = nullptr;
         VkDeviceSize subAllocatedSize = 0;
         uint32 memoryType;
+        Tiling tiling;
+
+        Tlsf blocks;
 
         // Keep track of all sub-allocations.
-        // map<offset, size>
-        std::map<VkDeviceSize, VkDeviceSize> resources;
+        // map<offset, suballocation>
+        std::unordered_map<VkDeviceSize, Suballocation> resources;
+    };
+
+    /**
+     * Small free suballocations owned by one thread, for one allocator.
+     *
+     * Only the owning thread uses it, except when the allocator drains it. Lock order is allocator then cache.
+     */
+    struct ThreadCache
+    {
+        std::mutex mutex;
+        // map<cacheKey(), free resources>
+        std::unordered_map<uint64, std::vector<ResourceMemory>> freeLists;
+        VkDeviceSize cachedSize = 0;
+    };
+
+    struct DedicatedAllocation
+    {
+        VkDeviceSize size;
+        uint32 memoryType;
     };
 
     struct Heap
     {
         VkDeviceSize size;
         VkDeviceSize allocatedSize = 0;
+        // Size of the largest big-allocation made in this heap.
+        VkDeviceSize maxAllocationSize;
+
+        // Boxed so resources can point to their big-allocation.
+        std::vector<std::unique_ptr<Allocation>> allocations;
+
+        // Dedicated allocations are not split, they are the resource memory itself.
+        std::unordered_map<VkDeviceMemory, DedicatedAllocation> dedicatedAllocations;
+    };
 
-        std::vector<Allocation> allocations;
+    /**
+     * Memory requirements along with the driver opinion about dedicated allocations.
+     */
+    struct Requirements
+    {
+        VkMemoryRequirements memory;
+        bool prefersDedicated = false;
+        bool requiresDedicated = false;
+    };
+    /**
+     * Memory types lacking a required flag are never used. Others are ranked by preferred and avoided flags.
+     */
+    struct MemoryPreference
+    {
+        VkMemoryPropertyFlags required = 0;
+        VkMemoryPropertyFlags preferred = 0;
+        VkMemoryPropertyFlags avoided = 0;
     };
+
     using MemoryType = uint32;
     using HeapIndex = uint32;
     using MemorySection = std::tuple<MemoryType, HeapIndex>;
 
-    static constexpr const VkDeviceSize allocationSize = 268435456u; // 256MB
+    static constexpr const VkDeviceSize maxAllocationSize = 268435456u; // 256MB
+    // A big-allocation never takes more than 1/heapFraction of its heap.
+    static constexpr const VkDeviceSize heapFraction = 8;
+    // The first big-allocation of a memory type is 2^allocationGrowthSteps times smaller than the largest one.
+    static constexpr const uint32 allocationGrowthSteps = 3;
+    // Without `VK_EXT_memory_budget`, assume the process may use this percentage of a heap.
+    static constexpr const VkDeviceSize fallbackBudgetPercent = 80;
+    // Suballocations up to smallSizeThreshold go through the thread caches, rounded to smallSizeGranularity.
+    static constexpr const VkDeviceSize smallSizeThreshold = 65536u; // 64KB
+    static constexpr const VkDeviceSize smallSizeGranularity = 256u;
+    // Bytes a thread may keep in its cache before frees go back to the blocks.
+    static constexpr const VkDeviceSize threadCacheSize = 1048576u; // 1MB
 
     explicit DeviceAllocator(not_null<LogicalDevice*> device);
 
     not_null<LogicalDevice*> _device;
+    // Identify this allocator in thread caches. Unlike its address, it is never reused.
+    uint64 _id;
+    // Boxed so the allocator stays movable. Guards everything below but the constants.
+    std::unique_ptr<std::mutex> _mutex = std::make_unique<std::mutex>();
+    // Caches of every thread which freed small resources. Dead threads' caches are dropped when drained.
+    std::vector<std::shared_ptr<ThreadCache>> _threadCaches;
     // _heaps represent available device heaps. They have same index as vulkan index.
     std::vector<Heap> _heaps;
+    VkPhysicalDeviceMemoryProperties _memories;
+    VkDeviceSize _bufferImageGranularity;
+    VkDeviceSize _nonCoherentAtomSize;
+
+    // Only loaded when `VK_KHR_dedicated_allocation` is enabled.
+    PFN_vkGetBufferMemoryRequirements2KHR _getBufferMemoryRequirements2 = nullptr;
+    PFN_vkGetImageMemoryRequirements2KHR _getImageMemoryRequirements2 = nullptr;
+
+    // Bytes the live resources actually request, and bytes they would take if rounded to a power of two.
+    VkDeviceSize _requestedSize = 0;
+    VkDeviceSize _roundedSize = 0;
 
+    static MemoryPreference memoryPreference(MemoryUsage usage);
+    /**
+     * Every memory type allowed by `memoryTypeBits` and suitable for `usage`, best first.
+     */
+    [[nodiscard]] std::vector<MemorySection> findMemoryTypes(uint32 memoryTypeBits, MemoryUsage usage) const;
+    bool allocateMemory(MemorySection section, Tiling tiling, VkMemoryRequirements requirements);
+    void releaseEmptyAllocation(HeapIndex heapIndex, Allocation const *empty);
+    void freeLocked(ResourceMemory const &resource);
+    /**
+     * Debug builds only: check that `resource` is a live suballocation overlapping none of its neighbours, so no two
+     * threads may own the same range. The allocator lock must be held.
+     */
+    void assertExclusive(ResourceMemory const &resource) const;
+    [[nodiscard]] usize allocatedSizeLocked() const;
 
-    MemorySection findMemoryType(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties);
-    void allocateMemory(MemorySection section);
-    std::optional<ResourceMemory> suballocateMemory(MemorySection Section, VkMemoryRequirements requirements);
+    static uint64 cacheKey(uint32 memoryType, Tiling tiling, VkDeviceSize size);
+    ThreadCache &threadCache();
+    std::optional<ResourceMemory> takeFromThreadCache(uint32 memoryType, Tiling tiling, VkMemoryRequirements requirements);
+    bool giveToThreadCache(ResourceMemory const &resource);
+    /**
+     * Give every cached resource back to its block. The allocator lock must be held.
+     */
+    void drainThreadCaches();
+    /**
+     * Whether `size` more bytes of device memory fit in the budget of `heapIndex`.
+     */
+    [[nodiscard]] bool isWithinBudget(HeapIndex heapIndex, VkDeviceSize size) const;
+    std::byte *mapMemory(VkDeviceMemory memory, uint32 memoryType);
+    [[nodiscard]] bool isCoherent(uint32 memoryType) const;
+    std::optional<VkMappedMemoryRange> nonCoherentRange(ResourceMemory const &resource, VkDeviceSize offset, VkDeviceSize size) const;
+    std::optional<ResourceMemory> allocateDedicatedMemory(MemorySection section, Tiling tiling, VkMemoryRequirements requirements,
+                                                          VkBuffer buffer, VkImage image);
+    ResourceMemory allocateResource(Requirements requirements, MemoryUsage usage, Tiling tiling,
+                                    VkBuffer buffer, VkImage image);
+    std::optional<ResourceMemory> allocateResourceInType(MemorySection memoryType, Requirements requirements, Tiling tiling,
+                                                         VkBuffer buffer, VkImage image);
+    std::optional<ResourceMemory> suballocateMemory(MemorySection Section, VkMemoryRequirements requirements, Tiling tiling);
+    std::optional<ResourceMemory> suballocateInAllocation(HeapIndex heapIndex, Allocation &allocation,
+                                                          VkMemoryRequirements requirements, Tiling tiling);
 };
 }
 
@@ -0,0 +1,60 @@
+#include "frameallocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace Engine::Vulkan;
+
+FrameAllocator FrameAllocator::create(not_null<LogicalDevice *> device, VkDeviceSize frameSize, usize frameCount)
+{
+    VkPhysicalDeviceLimits const limits = device->properties().limits;
+    VkDeviceSize const alignment = std::max(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment);
+
+    // Every frame region starts aligned.
+    frameSize = (frameSize + alignment - 1) / alignment * alignment;
+
+    auto buffer = Buffer::create(device,
+                                 VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                 frameSize * frameCount, DeviceAllocator::MemoryUsage::Streaming);
+
+    return FrameAllocator(std::move(buffer), frameSize, alignment);
+}
+
+FrameAllocator::FrameAllocator(Buffer &&buffer, VkDeviceSize frameSize, VkDeviceSize alignment) :
+_buffer(std::move(buffer)),
+_frameSize(frameSize),
+_alignment(alignment)
+{}
+
+void FrameAllocator::beginFrame(usize frame)
+{
+    _frameStart = frame * _frameSize;
+    _head = _frameStart;
+}
+
+FrameAllocator::Allocation FrameAllocator::allocate(VkDeviceSize size)
+{
+    VkDeviceSize const offset = (_head + _alignment - 1) / _alignment * _alignment;
+    if (offset + size > _frameStart + _frameSize)
+    {
+        throw std::runtime_error("Frame allocator is out of memory for this frame.");
+    }
+
+    _head = offset + size;
+
+    return {_buffer, offset, _buffer.data().subspan(offset, size)};
+}
+
+void FrameAllocator::flush()
+{
+    if (_head > _frameStart)
+    {
+        _buffer.flush(_frameStart, _head - _frameStart);
+    }
+}
+
+VkBuffer FrameAllocator::buffer() const
+{
+    return _buffer;
+}
@@ -0,0 +1,79 @@
+#ifndef VULKAN_ENGINE_FRAMEALLOCATOR_H
+#define VULKAN_ENGINE_FRAMEALLOCATOR_H
+
+#include <cstring>
+#include <span>
+#include <type_traits>
+
+#include "vulkan.h"
+#include "logicaldevice.h"
+#include "buffer.h"
+
+namespace Engine::Vulkan
+{
+/**
+ * Linear allocator for data living a single frame: uniforms, per-draw constants, dynamic geometry.
+ *
+ * It owns one persistently mapped buffer, split into one region per frame in flight. Allocating bumps the head of
+ * the current region, and a region is reclaimed as a whole when its frame starts again. It never goes through
+ * `DeviceAllocator` after creation.
+ */
+class FrameAllocator : public OnlyMovable
+{
+public:
+    struct Allocation
+    {
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        std::span<std::byte> data;
+    };
+
+    /**
+     * @param frameSize Bytes available to each frame.
+     * @param frameCount How many frames may be in flight at once.
+     */
+    [[nodiscard]] static FrameAllocator create(not_null<LogicalDevice*> device, VkDeviceSize frameSize, usize frameCount);
+
+    FrameAllocator(FrameAllocator &&) = default;
+    FrameAllocator &operator=(FrameAllocator &&) = default;
+
+    /**
+     * Make `frame` the current frame, and reclaim everything allocated the last time it was current.
+     * The device must be done with that previous frame: wait for its fence first.
+     */
+    void beginFrame(usize frame);
+    /**
+     * Reserve `size` bytes in the current frame. Offsets are aligned for uniform and storage buffer bindings.
+     */
+    [[nodiscard]] Allocation allocate(VkDeviceSize size);
+    /**
+     * Make the host writes of the current frame visible to the device. Call it before submitting the frame.
+     */
+    void flush();
+
+    template <class T>
+    Allocation push(T const &value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        Allocation allocation = allocate(sizeof(T));
+        std::memcpy(allocation.data.data(), &value, sizeof(T));
+        return allocation;
+    }
+
+    [[nodiscard]] VkBuffer buffer() const;
+
+private:
+    FrameAllocator(Buffer &&buffer, VkDeviceSize frameSize, VkDeviceSize alignment);
+
+    Buffer _buffer;
+    // Size of a frame region, a multiple of `_alignment`.
+    VkDeviceSize _frameSize;
+    VkDeviceSize _alignment;
+
+    VkDeviceSize _frameStart = 0;
+    VkDeviceSize _head = 0;
+};
+}
+
+#endif //VULKAN_ENGINE_FRAMEALLOCATOR_H
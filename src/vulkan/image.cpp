@@ -1,7 +1,13 @@
+#include <algorithm>
+#include <array>
+#include <span>
 #include <stdexcept>
-#include <stb_image.h>
+#include <utility>
+#include <vector>
 
 #include "image.h"
+#include "texturedata.h"
+#include "uploadservice.h"
 
 using namespace Engine::Vulkan;
 
@@ -10,7 +16,8 @@ Image Image::createFromExistingWithoutOwnership(not_null<VkImage> image)
     return Image(image);
 }
 
-Image Image::createEmpty(not_null<LogicalDevice*> device, VkExtent2D size, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage)
+Image Image::createEmpty(not_null<LogicalDevice*> device, VkExtent2D size, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
+                         uint32 mipLevels)
 {
     VkImageCreateInfo createInfo
     {
@@ -18,7 +25,7 @@ Image Image::createEmpty(not_null<LogicalDevice*> device, VkExtent2D size, VkFor
         .imageType = VK_IMAGE_TYPE_2D,
         .format = format,
         .extent = {.width = size.width, .height = size.height, .depth = 1},
-        .mipLevels = 1,
+        .mipLevels = mipLevels,
         .arrayLayers = 1,
         .samples = VK_SAMPLE_COUNT_1_BIT,
         .tiling = tiling,
@@ -30,66 +37,32 @@ Image Image::createEmpty(not_null<LogicalDevice*> device, VkExtent2D size, VkFor
     VkImage image = VK_NULL_HANDLE;
     ThrowError(vkCreateImage(*device, &createInfo, nullptr, &image));
 
-    VkMemoryRequirements requirements;
-    vkGetImageMemoryRequirements(*device, image, &requirements);
-
-    DeviceAllocator::ResourceMemory mem = device->allocator().allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    auto const allocationTiling = tiling == VK_IMAGE_TILING_LINEAR ? DeviceAllocator::Tiling::Linear : DeviceAllocator::Tiling::Optimal;
+    DeviceAllocator::ResourceMemory mem = device->allocator().allocateForImage(image, DeviceAllocator::MemoryUsage::GpuOnly, allocationTiling);
     vkBindImageMemory(*device, image, mem.memory, mem.offset);
 
-    return Image(image, device, mem);
+    return Image(image, device, mem, createInfo);
 }
 
-Image Image::createFromFile(const std::string &path, not_null<LogicalDevice *> device, CommandPool &commandPool, VkFormat format,
+Image Image::createFromFile(const std::string &path, not_null<LogicalDevice *> device, UploadService &uploads, VkFormat format,
                             VkImageTiling tiling, VkImageUsageFlags usage)
 {
-    spdlog::debug("Loading texture {}.", path);
-
-    int width {};
-    int height {};
-    int channels;
-
-    stbi_uc *pixels = stbi_load(path.c_str(), &width, &height, &channels,
-    STBI_rgb_alpha);
-
-    VkExtent2D size {.width = static_cast<uint32>(width), .height = static_cast<uint32>(height)};
-
-    if (!pixels)
-    {
-        throw std::runtime_error("can not open texture " + path);
-    }
-
-    VkDeviceSize imageSize = size.width * size.height * 4;
-    Buffer stagingBuffer = Buffer::create(device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, imageSize,
-                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-    {
-        void *data = nullptr;
-        stagingBuffer.map(&data);
-        memcpy(data, pixels, static_cast<size_t>(imageSize));
-        stagingBuffer.unmap();
-    }
-
-    stbi_image_free(pixels);
-
-    // The staging buffer now hold our texture
-    // We have to copy the staging buffer to our image texture
-
-    auto image = Image::createEmpty(device, size, format, tiling, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
-
-    // We have to send three commands:
-    // - Transition
-    // - Copy
-    // - Transition
+    return createFromData(TextureData::createFromFile(device, path, format, tiling), device, uploads, usage);
+}
 
-    auto cmdBuffer = CommandBuffer::create(device, &commandPool);
-    cmdBuffer.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+Image Image::createFromFirstSupportedFile(std::span<std::string const> paths, not_null<LogicalDevice *> device,
+                                          UploadService &uploads, VkFormat format, VkImageTiling tiling,
+                                          VkImageUsageFlags usage)
+{
+    return createFromFile(TextureData::findSupportedFile(device, paths, tiling), device, uploads, format, tiling, usage);
+}
 
-    image.cmdTransition(cmdBuffer, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    image.copyFromBuffer(cmdBuffer, stagingBuffer, size);
-    image.cmdTransition(cmdBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+Image Image::createFromData(TextureData &&data, not_null<LogicalDevice *> device, UploadService &uploads, VkImageUsageFlags usage)
+{
+    auto image = Image::createEmpty(device, data.size(), data.format(), data.tiling(), usage | data.usage(), data.mipLevels());
 
-    cmdBuffer.end();
-    cmdBuffer.submit(true);
+    // The upload service keeps the staging memory alive until the copy is complete.
+    uploads.uploadToImage(image, data.takeStaging(), data.regions());
 
     return image;
 }
@@ -98,12 +71,63 @@ Image::Image(not_null<VkImage> image) :
 _image(image)
 {}
 
-Image::Image(not_null<VkImage> image, not_null<LogicalDevice *> device, DeviceAllocator::ResourceMemory suballocation) :
+Image::Image(not_null<VkImage> image, not_null<LogicalDevice *> device, DeviceAllocator::ResourceMemory suballocation,
+             VkImageCreateInfo const &createInfo) :
 _image(image),
 _device(device),
-_suballocation(suballocation)
+_suballocation(suballocation),
+_createInfo(createInfo)
 {}
 
+Image::Image(Image &&other) :
+_image(std::move(other._image)),
+_device(other._device),
+_suballocation(other._suballocation),
+_createInfo(other._createInfo),
+_layout(std::move(other._layout)),
+_relocatable(other._relocatable),
+_onRelocated(std::move(other._onRelocated)),
+_relocation(std::exchange(other._relocation, std::nullopt))
+{
+    // The allocator calls the owner back through its address.
+    if (_image && _relocatable)
+    {
+        _device->get()->allocator().setRelocatable(*_suballocation, this);
+    }
+
+    if (_relocation)
+    {
+        _device->get()->allocator().setRelocatable(_relocation->memory, this);
+    }
+}
+
+Image &Image::operator=(Image &&other)
+{
+    std::swap(_image, other._image);
+    std::swap(_device, other._device);
+    std::swap(_suballocation, other._suballocation);
+    std::swap(_createInfo, other._createInfo);
+    std::swap(_layout, other._layout);
+    std::swap(_relocatable, other._relocatable);
+    std::swap(_onRelocated, other._onRelocated);
+    std::swap(_relocation, other._relocation);
+
+    for (Image *image : {this, &other})
+    {
+        if (image->_image && image->_relocatable)
+        {
+            image->_device->get()->allocator().setRelocatable(*image->_suballocation, image);
+        }
+
+        if (image->_relocation)
+        {
+            image->_device->get()->allocator().setRelocatable(image->_relocation->memory, image);
+        }
+    }
+
+    return *this;
+}
+
 Image::~Image()
 {
     if (_device.has_value())
@@ -111,6 +135,12 @@ Image::~Image()
         // We are the owner of the _image resource
         if (_image)
         {
+            // The range may be reused, the defragmenter must not call us back through it.
+            if (_relocatable)
+            {
+                _device->get()->allocator().setRelocatable(*_suballocation, nullptr);
+            }
+
             vkDestroyImage(**_device, _image, nullptr);
             _device->get()->allocator().free(*_suballocation);
         }
@@ -122,6 +152,22 @@ Image::operator VkImage() const
     return _image;
 }
 
+VkExtent2D Image::size() const
+{
+    return {.width = _createInfo.extent.width, .height = _createInfo.extent.height};
+}
+
+VkFormat Image::format() const
+{
+    return _createInfo.format;
+}
+
+uint32 Image::mipLevels() const
+{
+    // Images not created by us, like swapchain ones, have no create info.
+    return std::max(_createInfo.mipLevels, 1u);
+}
+
 void Image::cmdTransition(CommandBuffer &commandBuffer, VkImageLayout oldLayout, VkImageLayout newLayout)
 {
     VkImageMemoryBarrier barrier
@@ -136,7 +182,7 @@ void Image::cmdTransition(CommandBuffer &commandBuffer, VkImageLayout oldLayout,
          {
             .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
             .baseMipLevel = 0,
-            .levelCount = 1,
+            .levelCount = VK_REMAINING_MIP_LEVELS,
             .baseArrayLayer = 0,
             .layerCount = 1,
         },
@@ -159,6 +205,20 @@ void Image::cmdTransition(CommandBuffer &commandBuffer, VkImageLayout oldLayout,
         sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
         destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
     }
+    else if (oldLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)
+    {
+        barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        sourceStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+    {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    }
     else
     {
         throw std::invalid_argument("unsupported layout transition");
@@ -169,13 +229,15 @@ void Image::cmdTransition(CommandBuffer &commandBuffer, VkImageLayout oldLayout,
                          0, nullptr,
                          0, nullptr,
                          1, &barrier);
+
+    *_layout = newLayout;
 }
 
-void Image::copyFromBuffer(CommandBuffer &commandBuffer, Buffer &buffer, VkExtent2D size)
+void Image::copyFromBuffer(CommandBuffer &commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkExtent2D size)
 {
     VkBufferImageCopy region
     {
-        .bufferOffset = 0,
+        .bufferOffset = offset,
         .bufferRowLength = 0,
         .bufferImageHeight = 0,
         .imageSubresource =
@@ -186,8 +248,171 @@ void Image::copyFromBuffer(CommandBuffer &commandBuffer, Buffer &buffer, VkExten
             .layerCount = 1,
         },
         .imageOffset = {.x = 0, .y = 0, .z = 0},
-        .imageExtent = {.width = size.width, .height = size.height, 1},
+        .imageExtent = {.width = size.width, .height = size.height, .depth = 1},
     };
 
     vkCmdCopyBufferToImage(commandBuffer, buffer, _image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 }
+
+void Image::copyToBuffer(CommandBuffer &commandBuffer, VkBuffer buffer, std::span<VkBufferImageCopy const> regions)
+{
+    cmdTransition(commandBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    vkCmdCopyImageToBuffer(commandBuffer, _image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, static_cast<uint32>(regions.size()),
+                           regions.data());
+    cmdTransition(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
+void Image::setRelocatable(std::function<void(Image &)> onRelocated)
+{
+    if (!_device.has_value())
+    {
+        throw std::runtime_error("Only owned images can be relocated.");
+    }
+
+    _relocatable = true;
+    _onRelocated = std::move(onRelocated);
+    _device->get()->allocator().setRelocatable(*_suballocation, this);
+}
+
+bool Image::prepareRelocation(DeviceAllocator::ResourceMemory const &destination)
+{
+    if (*_layout != VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL || !(_createInfo.usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+    {
+        return false;
+    }
+
+    VkDevice device = **_device;
+
+    VkImageCreateInfo createInfo = _createInfo;
+    createInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+    VkImage image = VK_NULL_HANDLE;
+    ThrowError(vkCreateImage(device, &createInfo, nullptr, &image));
+
+    // The destination was planned for the old image, the transfer destination usage may change the requirements.
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device, image, &requirements);
+
+    if (!(requirements.memoryTypeBits & (1u << destination.memoryType())) || destination.offset % requirements.alignment != 0 ||
+        requirements.size > destination.size)
+    {
+        vkDestroyImage(device, image, nullptr);
+        return false;
+    }
+
+    ThrowError(vkBindImageMemory(device, image, destination.memory, destination.offset));
+
+    _relocation.emplace(PendingRelocation {image, destination});
+
+    return true;
+}
+
+void Image::recordRelocation(VkCommandBuffer commandBuffer)
+{
+    VkImage image = _relocation->image;
+
+    VkImageSubresourceRange const range
+    {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .baseMipLevel = 0,
+        .levelCount = _createInfo.mipLevels,
+        .baseArrayLayer = 0,
+        .layerCount = _createInfo.arrayLayers,
+    };
+
+    // Old image to transfer source, new image to transfer destination.
+    std::array<VkImageMemoryBarrier, 2> barriers
+    {
+        VkImageMemoryBarrier
+        {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = _image,
+            .subresourceRange = range,
+        },
+        VkImageMemoryBarrier
+        {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = image,
+            .subresourceRange = range,
+        },
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 0, nullptr, static_cast<uint32>(barriers.size()), barriers.data());
+
+    std::vector<VkImageCopy> regions;
+    for (uint32 level = 0; level < _createInfo.mipLevels; ++level)
+    {
+        VkImageSubresourceLayers const layers
+        {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = level,
+            .baseArrayLayer = 0,
+            .layerCount = _createInfo.arrayLayers,
+        };
+
+        regions.push_back(
+        {
+            .srcSubresource = layers,
+            .srcOffset = {.x = 0, .y = 0, .z = 0},
+            .dstSubresource = layers,
+            .dstOffset = {.x = 0, .y = 0, .z = 0},
+            .extent =
+            {
+                .width = std::max(_createInfo.extent.width >> level, 1u),
+                .height = std::max(_createInfo.extent.height >> level, 1u),
+                .depth = 1,
+            },
+        });
+    }
+    vkCmdCopyImage(commandBuffer, _image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   static_cast<uint32>(regions.size()), regions.data());
+
+    // The new image takes the place of the old one, ready to be sampled.
+    VkImageMemoryBarrier const toShaderRead
+    {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = range,
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &toShaderRead);
+}
+
+void Image::cancelRelocation()
+{
+    vkDestroyImage(**_device, _relocation->image, nullptr);
+    _relocation.reset();
+}
+
+void Image::completeRelocation()
+{
+    vkDestroyImage(**_device, _image, nullptr);
+    _device->get()->allocator().free(*_suballocation);
+
+    _image = std::move(_relocation->image);
+    _suballocation = _relocation->memory;
+    _relocation.reset();
+
+    if (_onRelocated)
+    {
+        _onRelocated(*this);
+    }
+}
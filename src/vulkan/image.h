@@ -1,6 +1,9 @@
 #ifndef VULKAN_ENGINE_IMAGE_H
 #define VULKAN_ENGINE_IMAGE_H
 
+#include <functional>
+#include <memory>
+#include <span>
 #include <string>
 
 #include "vulkan.h"
@@ -11,8 +14,12 @@
 
 namespace Engine::Vulkan
 {
-class Image : public OnlyMovable
+class TextureData;
+class UploadService;
+
+class Image : public OnlyMovable, public DeviceAllocator::Relocatable
 {
+friend class UploadService;
 public:
     /**
      * This constructor doesn't take ownership of `VkImage`.
@@ -21,16 +28,60 @@ public:
      * @param image The `VkImage` this instance reference.
      */
     [[nodiscard]] static Image createFromExistingWithoutOwnership(not_null<VkImage> image);
-    [[nodiscard]] static Image createEmpty(not_null<LogicalDevice*> device, VkExtent2D size, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage);
-    [[nodiscard]] static Image createFromFile(std::string const &path, not_null<LogicalDevice*> device, CommandPool &commandPool, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage);
+    [[nodiscard]] static Image createEmpty(not_null<LogicalDevice*> device, VkExtent2D size, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
+                                           uint32 mipLevels = 1);
+    /**
+     * The pixels are uploaded asynchronously: the image is usable once the next batch of `uploads` is complete.
+     *
+     * Optimal tiling images get a full mip chain, blitted by the device when the format supports linear filtering,
+     * generated on the CPU otherwise.
+     *
+     * `.ktx2` files are uploaded as stored, with their own format and mip levels: `format` is ignored.
+     */
+    [[nodiscard]] static Image createFromFile(std::string const &path, not_null<LogicalDevice*> device, UploadService &uploads, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage);
+    /**
+     * Load the first of `paths` the device can sample, typically the same texture compressed in several formats
+     * (BC7, ASTC, ...) followed by a PNG. Missing KTX2 files and KTX2 files in an unsupported format are skipped.
+     */
+    [[nodiscard]] static Image createFromFirstSupportedFile(std::span<std::string const> paths, not_null<LogicalDevice*> device, UploadService &uploads, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage);
+    /**
+     * Record the upload of `data`, decoded beforehand, possibly by a worker thread.
+     */
+    [[nodiscard]] static Image createFromData(TextureData &&data, not_null<LogicalDevice*> device, UploadService &uploads, VkImageUsageFlags usage);
 
-    ~Image();
-    Image(Image &&) = default;
-    Image &operator=(Image &&) = default;
+    ~Image() override;
+    Image(Image &&other);
+    Image &operator=(Image &&other);
     operator VkImage() const;
 
+    [[nodiscard]] VkExtent2D size() const;
+    [[nodiscard]] VkFormat format() const;
+    [[nodiscard]] uint32 mipLevels() const;
+
+    /**
+     * Transition every mip level.
+     */
     void cmdTransition(CommandBuffer &commandBuffer, VkImageLayout oldLayout, VkImageLayout newLayout);
-    void copyFromBuffer(CommandBuffer &commandBuffer, Buffer &buffer, VkExtent2D size);
+    void copyFromBuffer(CommandBuffer &commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkExtent2D size);
+    /**
+     * Copy `regions` of a sampled image to `buffer`, leaving the image ready to be sampled again. The image must have
+     * been created with `VK_IMAGE_USAGE_TRANSFER_SRC_BIT`.
+     */
+    void copyToBuffer(CommandBuffer &commandBuffer, VkBuffer buffer, std::span<VkBufferImageCopy const> regions);
+
+    /**
+     * Let the defragmenter move this image. Its handle changes when it does: `onRelocated` is then called so views
+     * and descriptors referencing the image can be recreated.
+     *
+     * Only images in `VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL` created with `VK_IMAGE_USAGE_TRANSFER_SRC_BIT` are
+     * moved.
+     */
+    void setRelocatable(std::function<void(Image &)> onRelocated = {});
+
+    bool prepareRelocation(DeviceAllocator::ResourceMemory const &destination) override;
+    void recordRelocation(VkCommandBuffer commandBuffer) override;
+    void cancelRelocation() override;
+    void completeRelocation() override;
 
 private:
     /**
@@ -44,7 +95,14 @@ private:
     /**
      * This constructor does take ownership of VkImage and its suballocation.
      */
-    Image(not_null<VkImage> image, not_null<LogicalDevice*> device, DeviceAllocator::ResourceMemory suballocation);
+    Image(not_null<VkImage> image, not_null<LogicalDevice*> device, DeviceAllocator::ResourceMemory suballocation,
+          VkImageCreateInfo const &createInfo);
+
+    struct PendingRelocation
+    {
+        VkHandle<VkImage> image;
+        DeviceAllocator::ResourceMemory memory;
+    };
 
     VkHandle<VkImage> _image;
 
@@ -52,6 +110,16 @@ private:
     // Otherwise, this instance doesn't have ownership of VkImage.
     std::optional<not_null<LogicalDevice*>> _device;
     std::optional<DeviceAllocator::ResourceMemory> _suballocation;
+
+    // Only meaningful for owned images. Needed to create the copy when relocating.
+    VkImageCreateInfo _createInfo {};
+    // Shared with the upload service, which sets it once the commands moving the image out of the transfer layout are
+    // recorded, possibly after this instance moved.
+    std::shared_ptr<VkImageLayout> _layout = std::make_shared<VkImageLayout>(VK_IMAGE_LAYOUT_UNDEFINED);
+
+    bool _relocatable = false;
+    std::function<void(Image &)> _onRelocated;
+    std::optional<PendingRelocation> _relocation;
 };
 }
 
@@ -14,7 +14,7 @@ ImageView ImageView::createFromImage(not_null<Image*> image, not_null<LogicalDev
         {
             .aspectMask = aspectFlags,
             .baseMipLevel = 0,
-            .levelCount = 1,
+            .levelCount = image->mipLevels(),
             .baseArrayLayer = 0,
             .layerCount = 1,
         },
@@ -27,12 +27,13 @@ Instance::~Instance()
     }
 }
 
-Instance::Instance(not_null<VkInstance> instance
+Instance::Instance(not_null<VkInstance> instance, std::set<std::string, std::less<>> enabledExtensions
 #ifndef NDEBUG
 , not_null<VkDebugUtilsMessengerEXT> debugMessenger
 #endif
 ) :
 _instance(instance),
+_enabledExtensions(std::move(enabledExtensions)),
 _debugMessenger(debugMessenger)
 {}
 
@@ -69,6 +70,13 @@ Instance Instance::create(std::span<const char *> _layers, std::span<const char
         throw std::runtime_error(std::string("At least one required instance extension is missing: ") + *missingExtension);
     }
 
+    // Optional extensions are only enabled when available.
+    auto optionalExtensions = filterAvailableExtensions(optionalInstanceExtensions);
+    std::copy(optionalExtensions.begin(), optionalExtensions.end(), std::back_inserter(extensions));
+
+    std::sort(extensions.begin(), extensions.end(), strcmp);
+    extensions.erase(std::unique(extensions.begin(), extensions.end(), areCStringEqual), extensions.end());
+
     VkInstanceCreateInfo info {};
     info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     info.flags = 0;
@@ -96,7 +104,7 @@ Instance Instance::create(std::span<const char *> _layers, std::span<const char
 
     spdlog::debug("Vulkan instance {}.{}.{} created.", major, minor, patch);
 
-    return Instance(instance, debugMessenger);
+    return Instance(instance, {extensions.begin(), extensions.end()}, debugMessenger);
 }
 
 std::optional<char const *> Instance::areLayersAvailable(const std::vector<const char *> &layers)
@@ -153,6 +161,21 @@ std::optional<char const *> Instance::areExtensionsAvailable(const std::vector<c
     return std::nullopt;
 }
 
+std::vector<char const *> Instance::filterAvailableExtensions(std::span<char const * const> extensions)
+{
+    std::vector<char const *> available {};
+
+    for (auto const *extension : extensions)
+    {
+        if (!areExtensionsAvailable({extension}).has_value())
+        {
+            available.push_back(extension);
+        }
+    }
+
+    return available;
+}
+
 #ifndef NDEBUG
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -191,6 +214,11 @@ not_null<VkInstance> Instance::get() const
     return _instance;
 }
 
+bool Instance::isExtensionEnabled(std::string_view extension) const
+{
+    return _enabledExtensions.contains(extension);
+}
+
 Instance::operator VkInstance() const
 {
     return _instance;
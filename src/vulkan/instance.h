@@ -3,8 +3,10 @@
 
 # include <array>
 # include <optional>
+# include <set>
 # include <span>
 # include <string>
+# include <string_view>
 
 # include "vulkan.h"
 
@@ -32,6 +34,14 @@ public:
 #endif
     };
 
+    /**
+     * Extensions enabled when the loader supports them. Check `isExtensionEnabled()` before relying on one.
+     */
+    static constexpr std::array const optionalInstanceExtensions
+    {
+        VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
+    };
+
     /**
      * Create a Vulkan Instance.
      *
@@ -46,15 +56,17 @@ public:
     [[nodiscard]] static Instance create(std::span<char const *> layers = {}, std::span<char const *> extensions = {});
 
     [[nodiscard]] not_null<VkInstance> get() const;
+    [[nodiscard]] bool isExtensionEnabled(std::string_view extension) const;
 
 private:
-    Instance(not_null<VkInstance> instance
+    Instance(not_null<VkInstance> instance, std::set<std::string, std::less<>> enabledExtensions
 #ifndef NDEBUG
 , not_null<VkDebugUtilsMessengerEXT> debugMessenger
 #endif
 );
 
     VkHandle<VkInstance> _instance;
+    std::set<std::string, std::less<>> _enabledExtensions;
 
 #ifndef NDEBUG
     VkHandle<VkDebugUtilsMessengerEXT> _debugMessenger;
@@ -74,6 +86,11 @@ private:
      */
     static std::optional<char const *> areExtensionsAvailable(std::vector<char const *> const &extensions);
 
+    /**
+     * @return The subset of `extensions` the loader supports.
+     */
+    static std::vector<char const *> filterAvailableExtensions(std::span<char const * const> extensions);
+
 #ifndef NDEBUG
     static not_null<VkDebugUtilsMessengerEXT> setupDebugMessenger(not_null<VkInstance> instance);
 #endif
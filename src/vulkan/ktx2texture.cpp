@@ -0,0 +1,197 @@
+#include "ktx2texture.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+using namespace Engine::Vulkan;
+
+namespace
+{
+constexpr std::array<unsigned char, 12> identifier {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+struct Header
+{
+    std::array<unsigned char, 12> identifier;
+    uint32 vkFormat;
+    uint32 typeSize;
+    uint32 pixelWidth;
+    uint32 pixelHeight;
+    uint32 pixelDepth;
+    uint32 layerCount;
+    uint32 faceCount;
+    uint32 levelCount;
+    uint32 supercompressionScheme;
+    uint32 dfdByteOffset;
+    uint32 dfdByteLength;
+    uint32 kvdByteOffset;
+    uint32 kvdByteLength;
+    uint64 sgdByteOffset;
+    uint64 sgdByteLength;
+};
+static_assert(sizeof(Header) == 80, "The KTX2 header is 80 bytes long.");
+
+struct LevelIndex
+{
+    uint64 byteOffset;
+    uint64 byteLength;
+    uint64 uncompressedByteLength;
+};
+static_assert(sizeof(LevelIndex) == 24, "A KTX2 level index entry is 24 bytes long.");
+
+std::optional<Header> readHeader(std::span<std::byte const> file)
+{
+    Header header {};
+    if (file.size() < sizeof(header))
+    {
+        return std::nullopt;
+    }
+
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.identifier != identifier)
+    {
+        return std::nullopt;
+    }
+
+    return header;
+}
+}
+
+Ktx2Texture Ktx2Texture::createFromFile(std::string const &path)
+{
+    std::ifstream stream(path, std::ios::ate | std::ios::binary);
+    if (!stream.is_open())
+    {
+        throw std::runtime_error("Can not open texture: " + path);
+    }
+
+    std::vector<std::byte> file(static_cast<usize>(stream.tellg()));
+    stream.seekg(0);
+    stream.read(reinterpret_cast<char *>(file.data()), static_cast<std::streamsize>(file.size()));
+
+    auto const header = readHeader(file);
+    if (!header.has_value())
+    {
+        throw std::runtime_error("Not a KTX2 file: " + path);
+    }
+
+    if (header->vkFormat == VK_FORMAT_UNDEFINED || header->supercompressionScheme != 0)
+    {
+        throw std::runtime_error("Basis Universal and supercompressed KTX2 files are not supported: " + path);
+    }
+
+    if (header->pixelHeight == 0 || header->pixelDepth > 1 || header->layerCount > 1 || header->faceCount != 1)
+    {
+        throw std::runtime_error("Only 2D KTX2 textures with one layer and one face are supported: " + path);
+    }
+
+    // No level in the file means the loader should generate them. Block compressed formats can't be, use one level.
+    uint32 const levelCount = std::max(header->levelCount, 1u);
+    if (file.size() < sizeof(Header) + levelCount * sizeof(LevelIndex))
+    {
+        throw std::runtime_error("Truncated KTX2 file: " + path);
+    }
+
+    std::vector<LevelIndex> levels(levelCount);
+    std::memcpy(levels.data(), file.data() + sizeof(Header), levelCount * sizeof(LevelIndex));
+
+    uint64 begin = file.size();
+    uint64 end = 0;
+    for (auto const &level : levels)
+    {
+        if (level.byteOffset + level.byteLength > file.size())
+        {
+            throw std::runtime_error("Truncated KTX2 file: " + path);
+        }
+
+        begin = std::min(begin, level.byteOffset);
+        end = std::max(end, level.byteOffset + level.byteLength);
+    }
+
+    VkExtent2D const size {.width = header->pixelWidth, .height = header->pixelHeight};
+
+    std::vector<VkBufferImageCopy> regions;
+    regions.reserve(levelCount);
+    for (uint32 level = 0; level < levelCount; ++level)
+    {
+        regions.push_back(
+        {
+            .bufferOffset = levels[level].byteOffset - begin,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+            .imageOffset = {.x = 0, .y = 0, .z = 0},
+            .imageExtent = {.width = std::max(size.width >> level, 1u), .height = std::max(size.height >> level, 1u), .depth = 1},
+        });
+    }
+
+    // Keep only the payload, it is what goes to staging memory.
+    file.erase(file.begin() + static_cast<std::ptrdiff_t>(end), file.end());
+    file.erase(file.begin(), file.begin() + static_cast<std::ptrdiff_t>(begin));
+
+    return Ktx2Texture(static_cast<VkFormat>(header->vkFormat), size, std::move(file), std::move(regions));
+}
+
+std::optional<VkFormat> Ktx2Texture::readFormat(std::string const &path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.is_open())
+    {
+        return std::nullopt;
+    }
+
+    std::array<std::byte, sizeof(Header)> bytes {};
+    stream.read(reinterpret_cast<char *>(bytes.data()), bytes.size());
+    if (stream.gcount() != static_cast<std::streamsize>(bytes.size()))
+    {
+        return std::nullopt;
+    }
+
+    auto const header = readHeader(bytes);
+    if (!header.has_value())
+    {
+        return std::nullopt;
+    }
+
+    return static_cast<VkFormat>(header->vkFormat);
+}
+
+Ktx2Texture::Ktx2Texture(VkFormat format, VkExtent2D size, std::vector<std::byte> &&data, std::vector<VkBufferImageCopy> &&regions) :
+_format(format),
+_size(size),
+_data(std::move(data)),
+_regions(std::move(regions))
+{}
+
+VkFormat Ktx2Texture::format() const
+{
+    return _format;
+}
+
+VkExtent2D Ktx2Texture::size() const
+{
+    return _size;
+}
+
+uint32 Ktx2Texture::levelCount() const
+{
+    return static_cast<uint32>(_regions.size());
+}
+
+std::span<std::byte const> Ktx2Texture::data() const
+{
+    return _data;
+}
+
+std::span<VkBufferImageCopy const> Ktx2Texture::regions() const
+{
+    return _regions;
+}
@@ -0,0 +1,55 @@
+#ifndef VULKAN_ENGINE_KTX2TEXTURE_H
+#define VULKAN_ENGINE_KTX2TEXTURE_H
+
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "vulkan.h"
+
+namespace Engine::Vulkan
+{
+/**
+ * Texture loaded from a KTX2 container, kept in its stored format: block compressed payloads (BCn, ASTC, ...) and
+ * pre-baked mip levels are given to the device as they are, without decoding.
+ *
+ * Only 2D textures with a single layer and face are supported, without supercompression.
+ */
+class Ktx2Texture : public OnlyMovable
+{
+public:
+    [[nodiscard]] static Ktx2Texture createFromFile(std::string const &path);
+    /**
+     * Read only the header of a KTX2 file.
+     *
+     * @return `std::nullopt` if the file can't be opened or isn't a KTX2 file.
+     */
+    [[nodiscard]] static std::optional<VkFormat> readFormat(std::string const &path);
+
+    Ktx2Texture(Ktx2Texture &&) noexcept = default;
+    Ktx2Texture &operator=(Ktx2Texture &&) noexcept = default;
+
+    [[nodiscard]] VkFormat format() const;
+    [[nodiscard]] VkExtent2D size() const;
+    [[nodiscard]] uint32 levelCount() const;
+    /**
+     * Payload of every level, in the order of the file (smallest level first).
+     */
+    [[nodiscard]] std::span<std::byte const> data() const;
+    /**
+     * One copy region per level, offsets relative to `data()`.
+     */
+    [[nodiscard]] std::span<VkBufferImageCopy const> regions() const;
+
+private:
+    Ktx2Texture(VkFormat format, VkExtent2D size, std::vector<std::byte> &&data, std::vector<VkBufferImageCopy> &&regions);
+
+    VkFormat _format;
+    VkExtent2D _size;
+    std::vector<std::byte> _data;
+    std::vector<VkBufferImageCopy> _regions;
+};
+}
+
+#endif //VULKAN_ENGINE_KTX2TEXTURE_H
@@ -1,4 +1,5 @@
 #include "logicaldevice.h"
+#include <algorithm>
 #include <set>
 #include <utility>
 
@@ -42,8 +43,9 @@ LogicalDevice LogicalDevice::create(PhysicalDevice &&physicalDevice)
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
     createInfo.pEnabledFeatures = &deviceFeatures;
 
-    createInfo.enabledExtensionCount = static_cast<uint32>(PhysicalDevice::requiredDeviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = PhysicalDevice::requiredDeviceExtensions.data();
+    auto const extensions = physicalDevice.enabledExtensions();
+    createInfo.enabledExtensionCount = static_cast<uint32>(extensions.size());
+    createInfo.ppEnabledExtensionNames = extensions.data();
 
     createInfo.enabledLayerCount = static_cast<uint32>(PhysicalDevice::requiredValidationLayers.size());
     createInfo.ppEnabledLayerNames = PhysicalDevice::requiredValidationLayers.data();
@@ -128,6 +130,26 @@ VkPhysicalDeviceMemoryProperties LogicalDevice::memories() const
     return _physicalDevice.memories();
 }
 
+VkFormatProperties LogicalDevice::formatProperties(VkFormat format) const
+{
+    return _physicalDevice.formatProperties(format);
+}
+
+std::optional<VkPhysicalDeviceMemoryBudgetPropertiesEXT> LogicalDevice::memoryBudget() const
+{
+    return _physicalDevice.memoryBudget();
+}
+
+bool LogicalDevice::isExtensionEnabled(std::string_view extension) const
+{
+    auto const extensions = _physicalDevice.enabledExtensions();
+
+    return std::any_of(extensions.begin(), extensions.end(), [extension](char const *enabled)
+    {
+        return extension == enabled;
+    });
+}
+
 DeviceAllocator &LogicalDevice::allocator()
 {
     return *_allocator;
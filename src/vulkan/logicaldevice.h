@@ -45,6 +45,9 @@ public:
     [[nodiscard]] VkPhysicalDeviceProperties properties() const;
     [[nodiscard]] VkPhysicalDeviceFeatures features() const;
     [[nodiscard]] VkPhysicalDeviceMemoryProperties memories() const;
+    [[nodiscard]] VkFormatProperties formatProperties(VkFormat format) const;
+    [[nodiscard]] std::optional<VkPhysicalDeviceMemoryBudgetPropertiesEXT> memoryBudget() const;
+    [[nodiscard]] bool isExtensionEnabled(std::string_view extension) const;
 
 private:
     LogicalDevice(not_null<VkDevice> device, PhysicalDevice &&physicalDevice, Queues queues);
@@ -0,0 +1,862 @@
+#include "meshoptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <unordered_map>
+
+using namespace Engine::Vulkan;
+
+namespace
+{
+/**
+ * FIFO cache of vertex indices. A vertex is cached as long as less than `cacheSize` misses happened since it was
+ * inserted, so only its insertion time is stored.
+ */
+class CacheSimulator
+{
+public:
+    CacheSimulator(usize vertexCount, uint32 cacheSize) :
+    _insertedAt(vertexCount, 0),
+    _cacheSize(cacheSize),
+    // Never inserted vertices, at 0, are evicted from the start.
+    _time(cacheSize + 1)
+    {}
+
+    /**
+     * @return Whether `vertex` had to be transformed.
+     */
+    bool access(uint32 vertex)
+    {
+        if (_time - _insertedAt[vertex] > _cacheSize)
+        {
+            _insertedAt[vertex] = _time++;
+            return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * @return How long ago, in misses, `vertex` got into the cache.
+     */
+    [[nodiscard]] uint32 age(uint32 vertex) const
+    {
+        return _time - _insertedAt[vertex];
+    }
+
+    void flush()
+    {
+        _time += _cacheSize + 1;
+    }
+
+private:
+    std::vector<uint32> _insertedAt;
+    uint32 _cacheSize;
+    uint32 _time;
+};
+
+/**
+ * Sum of squared distances to planes: `error(p) = p.A.p + 2 b.p + c`, with A symmetric. Weights are summed too, to
+ * turn it into a mean.
+ */
+struct Quadric
+{
+    double a00 = 0., a01 = 0., a02 = 0., a11 = 0., a12 = 0., a22 = 0.;
+    double b0 = 0., b1 = 0., b2 = 0.;
+    double c = 0.;
+    double weight = 0.;
+
+    /**
+     * @param normal Unit normal of the plane of equation `dot(normal, p) + distance = 0`.
+     */
+    static Quadric fromPlane(glm::vec3 normal, float distance, double weight)
+    {
+        double const x = normal.x;
+        double const y = normal.y;
+        double const z = normal.z;
+        double const d = distance;
+
+        return {
+            .a00 = weight * x * x, .a01 = weight * x * y, .a02 = weight * x * z,
+            .a11 = weight * y * y, .a12 = weight * y * z,
+            .a22 = weight * z * z,
+            .b0 = weight * x * d, .b1 = weight * y * d, .b2 = weight * z * d,
+            .c = weight * d * d,
+            .weight = weight,
+        };
+    }
+
+    Quadric &operator+=(Quadric const &other)
+    {
+        a00 += other.a00; a01 += other.a01; a02 += other.a02;
+        a11 += other.a11; a12 += other.a12;
+        a22 += other.a22;
+        b0 += other.b0; b1 += other.b1; b2 += other.b2;
+        c += other.c;
+        weight += other.weight;
+        return *this;
+    }
+
+    /**
+     * Weighted sum of the squared distances from `p` to the planes. With unit weights, it bounds the square of the
+     * largest of these distances.
+     */
+    [[nodiscard]] double sum(glm::vec3 p) const
+    {
+        double const x = p.x;
+        double const y = p.y;
+        double const z = p.z;
+        double const e = a00 * x * x + a11 * y * y + a22 * z * z + 2. * (a01 * x * y + a02 * x * z + a12 * y * z) +
+            2. * (b0 * x + b1 * y + b2 * z) + c;
+
+        // Rounding may bring it slightly below zero.
+        return std::max(e, 0.);
+    }
+
+    /**
+     * Weighted mean of the squared distances from `p` to the planes.
+     */
+    [[nodiscard]] double error(glm::vec3 p) const
+    {
+        return weight > 0. ? sum(p) / weight : 0.;
+    }
+};
+
+uint64 edgeKey(uint32 a, uint32 b)
+{
+    return (static_cast<uint64>(std::min(a, b)) << 32) | std::max(a, b);
+}
+
+void computeBounds(MeshOptimizer::Meshlet &meshlet, MeshOptimizer::Meshlets const &meshlets,
+                   std::span<glm::vec3 const> positions)
+{
+    auto const position = [&](uint32 local)
+    {
+        return positions[meshlets.vertices[meshlet.vertexOffset + local]];
+    };
+
+    glm::vec3 min(std::numeric_limits<float>::max());
+    glm::vec3 max(std::numeric_limits<float>::lowest());
+    for (uint32 v = 0; v < meshlet.vertexCount; v++)
+    {
+        min = glm::min(min, position(v));
+        max = glm::max(max, position(v));
+    }
+
+    meshlet.center = (min + max) / 2.f;
+    meshlet.radius = 0.f;
+    for (uint32 v = 0; v < meshlet.vertexCount; v++)
+    {
+        meshlet.radius = std::max(meshlet.radius, glm::distance(meshlet.center, position(v)));
+    }
+
+    std::vector<glm::vec3> normals;
+    normals.reserve(meshlet.triangleCount);
+    glm::vec3 normalSum(0.f);
+    for (uint32 t = meshlet.triangleOffset; t < meshlet.triangleOffset + meshlet.triangleCount; t++)
+    {
+        glm::vec3 const p0 = position(meshlets.triangles[3 * t + 0]);
+        glm::vec3 const p1 = position(meshlets.triangles[3 * t + 1]);
+        glm::vec3 const p2 = position(meshlets.triangles[3 * t + 2]);
+        glm::vec3 const normal = glm::cross(p1 - p0, p2 - p0);
+
+        // Degenerate triangles are never rasterized, they don't constrain the cone.
+        if (float const length = glm::length(normal); length > 0.f)
+        {
+            normals.push_back(normal / length);
+            normalSum += normals.back();
+        }
+    }
+
+    // A cutoff of 1 never culls.
+    meshlet.coneAxis = glm::vec3(0.f);
+    meshlet.coneCutoff = 1.f;
+
+    float const sumLength = glm::length(normalSum);
+    if (normals.empty() || sumLength == 0.f)
+    {
+        return;
+    }
+
+    meshlet.coneAxis = normalSum / sumLength;
+    float minDot = 1.f;
+    for (auto const &normal : normals)
+    {
+        minDot = std::min(minDot, glm::dot(normal, meshlet.coneAxis));
+    }
+
+    // Past 90 degrees, some triangle faces every viewpoint.
+    if (minDot > 0.f)
+    {
+        meshlet.coneCutoff = std::sqrt(1.f - minDot * minDot);
+    }
+}
+}
+
+MeshOptimizer::CacheStatistics MeshOptimizer::analyzeVertexCache(std::span<uint32 const> indices, usize vertexCount,
+                                                                 uint32 cacheSize)
+{
+    if (indices.empty() || vertexCount == 0)
+    {
+        return {};
+    }
+
+    CacheSimulator cache(vertexCount, cacheSize);
+    usize misses = 0;
+    for (uint32 const index : indices)
+    {
+        misses += cache.access(index);
+    }
+
+    return {
+        .acmr = static_cast<float>(misses) / static_cast<float>(indices.size() / 3),
+        .atvr = static_cast<float>(misses) / static_cast<float>(vertexCount),
+    };
+}
+
+std::vector<uint32> MeshOptimizer::optimizeVertexCache(std::span<uint32 const> indices, usize vertexCount,
+                                                       std::vector<uint32> &clusters, uint32 cacheSize)
+{
+    usize const triangleCount = indices.size() / 3;
+
+    // Triangles around each vertex, packed.
+    std::vector<uint32> adjacencyOffsets(vertexCount + 1, 0);
+    for (uint32 const index : indices)
+    {
+        adjacencyOffsets[index + 1]++;
+    }
+    std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+
+    std::vector<uint32> adjacency(indices.size());
+    {
+        std::vector<uint32> cursors(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (usize i = 0; i < indices.size(); i++)
+        {
+            adjacency[cursors[indices[i]]++] = static_cast<uint32>(i / 3);
+        }
+    }
+
+    // Number of triangles not emitted yet around each vertex.
+    std::vector<uint32> live(vertexCount);
+    for (usize vertex = 0; vertex < vertexCount; vertex++)
+    {
+        live[vertex] = adjacencyOffsets[vertex + 1] - adjacencyOffsets[vertex];
+    }
+
+    std::vector<bool> emitted(triangleCount, false);
+    CacheSimulator cache(vertexCount, cacheSize);
+
+    std::vector<uint32> result;
+    result.reserve(triangleCount * 3);
+    clusters.clear();
+
+    // Recently used vertices, to go back to when the current fan has no good follower.
+    std::vector<uint32> deadEnd;
+    std::vector<uint32> candidates;
+    usize cursor = 0;
+
+    auto const nextVertex = [&]() -> std::optional<uint32>
+    {
+        // The candidate which is the most recently cached and will still be once its fan is emitted.
+        std::optional<uint32> best;
+        int64 bestPriority = -1;
+        for (uint32 const candidate : candidates)
+        {
+            if (live[candidate] == 0)
+            {
+                continue;
+            }
+
+            int64 priority = 0;
+            if (cache.age(candidate) + 2 * live[candidate] <= cacheSize)
+            {
+                priority = cache.age(candidate);
+            }
+
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                best = candidate;
+            }
+        }
+
+        return best;
+    };
+
+    auto const skipDeadEnd = [&]() -> std::optional<uint32>
+    {
+        while (!deadEnd.empty())
+        {
+            uint32 const vertex = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[vertex] > 0)
+            {
+                return vertex;
+            }
+        }
+
+        while (cursor < vertexCount)
+        {
+            if (live[cursor] > 0)
+            {
+                return static_cast<uint32>(cursor);
+            }
+            cursor++;
+        }
+
+        return std::nullopt;
+    };
+
+    std::optional<uint32> fanning = skipDeadEnd();
+    bool jumped = true;
+    while (fanning)
+    {
+        candidates.clear();
+
+        for (uint32 a = adjacencyOffsets[*fanning]; a < adjacencyOffsets[*fanning + 1]; a++)
+        {
+            uint32 const triangle = adjacency[a];
+            if (emitted[triangle])
+            {
+                continue;
+            }
+
+            if (jumped)
+            {
+                clusters.push_back(static_cast<uint32>(result.size() / 3));
+                jumped = false;
+            }
+
+            for (usize corner = 0; corner < 3; corner++)
+            {
+                uint32 const vertex = indices[3 * triangle + corner];
+                result.push_back(vertex);
+                deadEnd.push_back(vertex);
+                candidates.push_back(vertex);
+                live[vertex]--;
+                cache.access(vertex);
+            }
+
+            emitted[triangle] = true;
+        }
+
+        fanning = nextVertex();
+        if (!fanning)
+        {
+            fanning = skipDeadEnd();
+            jumped = true;
+        }
+    }
+
+    return result;
+}
+
+std::vector<uint32> MeshOptimizer::optimizeOverdraw(std::span<uint32 const> indices,
+                                                    std::span<glm::vec3 const> positions,
+                                                    std::span<uint32 const> clusters, float threshold,
+                                                    uint32 cacheSize)
+{
+    usize const triangleCount = indices.size() / 3;
+    if (triangleCount == 0 || clusters.empty())
+    {
+        return {indices.begin(), indices.end()};
+    }
+
+    // Split clusters where it costs little. A cluster may be drawn after any other, so it starts with a cold cache.
+    float const acmr = analyzeVertexCache(indices, positions.size(), cacheSize).acmr;
+
+    std::vector<uint32> boundaries;
+    CacheSimulator cache(positions.size(), cacheSize);
+    for (usize c = 0; c < clusters.size(); c++)
+    {
+        usize const end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+
+        usize start = clusters[c];
+        usize misses = 0;
+        boundaries.push_back(static_cast<uint32>(start));
+        cache.flush();
+
+        for (usize triangle = start; triangle < end; triangle++)
+        {
+            for (usize corner = 0; corner < 3; corner++)
+            {
+                misses += cache.access(indices[3 * triangle + corner]);
+            }
+
+            auto const localAcmr = static_cast<float>(misses) / static_cast<float>(triangle + 1 - start);
+            if (triangle + 1 < end && localAcmr <= threshold * acmr)
+            {
+                start = triangle + 1;
+                misses = 0;
+                boundaries.push_back(static_cast<uint32>(start));
+                cache.flush();
+            }
+        }
+    }
+
+    auto const trianglePosition = [&](usize triangle, usize corner)
+    {
+        return positions[indices[3 * triangle + corner]];
+    };
+
+    glm::vec3 meshCentroid(0.f);
+    float meshArea = 0.f;
+    for (usize triangle = 0; triangle < triangleCount; triangle++)
+    {
+        glm::vec3 const a = trianglePosition(triangle, 0);
+        glm::vec3 const b = trianglePosition(triangle, 1);
+        glm::vec3 const c = trianglePosition(triangle, 2);
+        float const area = glm::length(glm::cross(b - a, c - a));
+        meshCentroid += area * (a + b + c) / 3.f;
+        meshArea += area;
+    }
+    meshCentroid = meshArea > 0.f ? meshCentroid / meshArea : meshCentroid;
+
+    // Clusters far from the center and facing outward occlude the rest of the mesh: they are drawn first.
+    std::vector<float> sortKeys(boundaries.size());
+    for (usize b = 0; b < boundaries.size(); b++)
+    {
+        usize const end = b + 1 < boundaries.size() ? boundaries[b + 1] : triangleCount;
+
+        glm::vec3 centroid(0.f);
+        glm::vec3 normal(0.f);
+        float area = 0.f;
+        for (usize triangle = boundaries[b]; triangle < end; triangle++)
+        {
+            glm::vec3 const p0 = trianglePosition(triangle, 0);
+            glm::vec3 const p1 = trianglePosition(triangle, 1);
+            glm::vec3 const p2 = trianglePosition(triangle, 2);
+            glm::vec3 const cross = glm::cross(p1 - p0, p2 - p0);
+            float const triangleArea = glm::length(cross);
+
+            centroid += triangleArea * (p0 + p1 + p2) / 3.f;
+            normal += cross;
+            area += triangleArea;
+        }
+
+        float const normalLength = glm::length(normal);
+        sortKeys[b] = area > 0.f && normalLength > 0.f ? glm::dot(centroid / area - meshCentroid, normal / normalLength) : 0.f;
+    }
+
+    std::vector<usize> order(boundaries.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&sortKeys](usize a, usize b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32> result;
+    result.reserve(indices.size());
+    for (usize const b : order)
+    {
+        usize const end = b + 1 < boundaries.size() ? boundaries[b + 1] : triangleCount;
+        result.insert(result.end(), indices.begin() + 3 * boundaries[b], indices.begin() + 3 * end);
+    }
+
+    return result;
+}
+
+std::vector<uint32> MeshOptimizer::vertexFetchRemap(std::span<uint32 const> indices, usize vertexCount)
+{
+    std::vector<uint32> remap(vertexCount, unusedVertex);
+
+    uint32 next = 0;
+    for (uint32 const index : indices)
+    {
+        if (remap[index] == unusedVertex)
+        {
+            remap[index] = next++;
+        }
+    }
+
+    return remap;
+}
+
+MeshOptimizer::Meshlets MeshOptimizer::buildMeshlets(std::span<uint32 const> indices, std::span<glm::vec3 const> positions,
+                                                     uint32 maxVertices, uint32 maxTriangles)
+{
+    // Local indices are stored on 8 bits.
+    constexpr uint8 notInMeshlet = 0xff;
+    maxVertices = std::min<uint32>(maxVertices, notInMeshlet);
+
+    Meshlets result;
+    Meshlet current {};
+    std::vector<uint8> local(positions.size(), notInMeshlet);
+
+    auto const finish = [&]()
+    {
+        if (current.triangleCount == 0)
+        {
+            return;
+        }
+
+        computeBounds(current, result, positions);
+        for (uint32 v = current.vertexOffset; v < current.vertexOffset + current.vertexCount; v++)
+        {
+            local[result.vertices[v]] = notInMeshlet;
+        }
+
+        result.meshlets.push_back(current);
+        current = {
+            .vertexOffset = static_cast<uint32>(result.vertices.size()),
+            .triangleOffset = static_cast<uint32>(result.triangles.size() / 3),
+        };
+    };
+
+    for (usize triangle = 0; triangle < indices.size() / 3; triangle++)
+    {
+        uint32 const a = indices[3 * triangle + 0];
+        uint32 const b = indices[3 * triangle + 1];
+        uint32 const c = indices[3 * triangle + 2];
+
+        uint32 const newVertices = (local[a] == notInMeshlet) +
+            (b != a && local[b] == notInMeshlet) +
+            (c != a && c != b && local[c] == notInMeshlet);
+
+        if (current.vertexCount + newVertices > maxVertices || current.triangleCount + 1 > maxTriangles)
+        {
+            finish();
+        }
+
+        for (uint32 const vertex : {a, b, c})
+        {
+            if (local[vertex] == notInMeshlet)
+            {
+                local[vertex] = static_cast<uint8>(current.vertexCount++);
+                result.vertices.push_back(vertex);
+            }
+            result.triangles.push_back(local[vertex]);
+        }
+        current.triangleCount++;
+    }
+    finish();
+
+    return result;
+}
+
+std::vector<uint32> MeshOptimizer::simplify(std::span<uint32 const> indices, std::span<glm::vec3 const> positions,
+                                            usize targetIndexCount, float targetError, float &error,
+                                            std::span<uint8 const> lockedVertices)
+{
+    error = 0.f;
+    std::vector<uint32> result(indices.begin(), indices.end());
+
+    // Vertices split by texture coordinates share their position: collapses work on positions. Only the vertices
+    // referenced by `indices` are looked at, it may be a part of a larger mesh.
+    std::vector<uint32> referenced;
+    std::vector<uint32> positionOf(positions.size(), unusedVertex);
+    std::vector<glm::vec3> uniquePositions;
+    {
+        std::unordered_map<glm::vec3, uint32> ids;
+        for (uint32 const vertex : indices)
+        {
+            if (positionOf[vertex] != unusedVertex)
+            {
+                continue;
+            }
+
+            auto const [it, inserted] = ids.try_emplace(positions[vertex], static_cast<uint32>(uniquePositions.size()));
+            if (inserted)
+            {
+                uniquePositions.push_back(positions[vertex]);
+            }
+            positionOf[vertex] = it->second;
+            referenced.push_back(vertex);
+        }
+    }
+    usize const positionCount = uniquePositions.size();
+
+    // Vertices of each position.
+    std::vector<uint32> vertexOffsets(positionCount + 1, 0);
+    for (uint32 const vertex : referenced)
+    {
+        vertexOffsets[positionOf[vertex] + 1]++;
+    }
+    std::partial_sum(vertexOffsets.begin(), vertexOffsets.end(), vertexOffsets.begin());
+    std::vector<uint32> verticesOfPosition(referenced.size());
+    {
+        std::vector<uint32> cursors(vertexOffsets.begin(), vertexOffsets.end() - 1);
+        for (uint32 const vertex : referenced)
+        {
+            verticesOfPosition[cursors[positionOf[vertex]]++] = vertex;
+        }
+    }
+
+    auto const countEdges = [&]()
+    {
+        std::unordered_map<uint64, uint32> edges;
+        for (usize i = 0; i < result.size(); i += 3)
+        {
+            for (usize corner = 0; corner < 3; corner++)
+            {
+                edges[edgeKey(positionOf[result[i + corner]], positionOf[result[i + (corner + 1) % 3]])]++;
+            }
+        }
+        return edges;
+    };
+
+    // Quadrics of the input surface. Open borders also get planes orthogonal to them, so they don't shrink.
+    // Collapses are ordered by the area weighted mean distance, but the error is bounded with the same planes unweighted.
+    std::vector<Quadric> quadrics(positionCount);
+    std::vector<Quadric> bounds(positionCount);
+    std::vector<bool> locked(positionCount, false);
+    if (!lockedVertices.empty())
+    {
+        for (uint32 const vertex : referenced)
+        {
+            if (lockedVertices[vertex] != 0)
+            {
+                locked[positionOf[vertex]] = true;
+            }
+        }
+    }
+    {
+        auto const edges = countEdges();
+        for (usize i = 0; i < result.size(); i += 3)
+        {
+            std::array<uint32, 3> const triangle {positionOf[result[i]], positionOf[result[i + 1]], positionOf[result[i + 2]]};
+            std::array<glm::vec3, 3> const p {uniquePositions[triangle[0]], uniquePositions[triangle[1]], uniquePositions[triangle[2]]};
+
+            glm::vec3 const cross = glm::cross(p[1] - p[0], p[2] - p[0]);
+            float const length = glm::length(cross);
+            if (length == 0.f)
+            {
+                continue;
+            }
+
+            glm::vec3 const normal = cross / length;
+            auto const quadric = Quadric::fromPlane(normal, -glm::dot(normal, p[0]), length / 2.f);
+            auto const bound = Quadric::fromPlane(normal, -glm::dot(normal, p[0]), 1.);
+            for (uint32 const position : triangle)
+            {
+                quadrics[position] += quadric;
+                bounds[position] += bound;
+            }
+
+            for (usize corner = 0; corner < 3; corner++)
+            {
+                uint32 const a = triangle[corner];
+                uint32 const b = triangle[(corner + 1) % 3];
+                auto const count = edges.at(edgeKey(a, b));
+
+                if (count == 1)
+                {
+                    glm::vec3 const edge = p[(corner + 1) % 3] - p[corner];
+                    glm::vec3 const borderNormal = glm::normalize(glm::cross(edge, normal));
+                    auto const border = Quadric::fromPlane(borderNormal, -glm::dot(borderNormal, p[corner]),
+                                                           glm::dot(edge, edge));
+                    auto const borderBound = Quadric::fromPlane(borderNormal, -glm::dot(borderNormal, p[corner]), 1.);
+                    quadrics[a] += border;
+                    quadrics[b] += border;
+                    bounds[a] += borderBound;
+                    bounds[b] += borderBound;
+                }
+                else if (count > 2)
+                {
+                    // Non manifold edges have no sensible collapse.
+                    locked[a] = true;
+                    locked[b] = true;
+                }
+            }
+        }
+    }
+
+    double const errorLimit = static_cast<double>(targetError) * targetError;
+
+    struct Collapse
+    {
+        uint32 from;
+        uint32 to;
+        double cost;
+        // Square of the largest distance from the target to the planes merged into it.
+        double bound;
+    };
+
+    std::vector<Collapse> collapses;
+    std::vector<uint32> remap(positions.size());
+    std::vector<bool> touched(positionCount);
+    std::vector<bool> border(positionCount);
+    std::vector<bool> used(positions.size());
+
+    while (result.size() > targetIndexCount)
+    {
+        auto const edges = countEdges();
+
+        std::fill(border.begin(), border.end(), false);
+        for (auto const &[key, count] : edges)
+        {
+            if (count == 1)
+            {
+                border[key >> 32] = true;
+                border[key & 0xffffffff] = true;
+            }
+        }
+
+        // The vertex on the other side of each edge from each vertex, where that vertex goes when the edge collapses.
+        std::unordered_map<uint64, uint32> counterparts;
+        std::fill(used.begin(), used.end(), false);
+        for (usize i = 0; i < result.size(); i += 3)
+        {
+            for (usize corner = 0; corner < 3; corner++)
+            {
+                uint32 const vertex = result[i + corner];
+                used[vertex] = true;
+                for (usize other = 1; other < 3; other++)
+                {
+                    uint32 const neighbour = result[i + (corner + other) % 3];
+                    counterparts.try_emplace((static_cast<uint64>(vertex) << 32) | positionOf[neighbour], neighbour);
+                }
+            }
+        }
+
+        // Triangles around each position, for the flip test.
+        std::vector<uint32> triangleOffsets(positionCount + 1, 0);
+        for (uint32 const vertex : result)
+        {
+            triangleOffsets[positionOf[vertex] + 1]++;
+        }
+        std::partial_sum(triangleOffsets.begin(), triangleOffsets.end(), triangleOffsets.begin());
+        std::vector<uint32> trianglesOfPosition(result.size());
+        {
+            std::vector<uint32> cursors(triangleOffsets.begin(), triangleOffsets.end() - 1);
+            for (usize i = 0; i < result.size(); i++)
+            {
+                trianglesOfPosition[cursors[positionOf[result[i]]]++] = static_cast<uint32>(i / 3);
+            }
+        }
+
+        collapses.clear();
+        for (auto const &[key, count] : edges)
+        {
+            auto const a = static_cast<uint32>(key >> 32);
+            auto const b = static_cast<uint32>(key & 0xffffffff);
+            if (a == b)
+            {
+                continue;
+            }
+
+            for (auto const &[from, to] : {std::pair {a, b}, std::pair {b, a}})
+            {
+                // Border vertices only slide along the border.
+                if (locked[from] || (border[from] && count != 1))
+                {
+                    continue;
+                }
+
+                Quadric quadric = quadrics[from];
+                quadric += quadrics[to];
+                Quadric bound = bounds[from];
+                bound += bounds[to];
+                collapses.push_back({from, to, quadric.error(uniquePositions[to]), bound.sum(uniquePositions[to])});
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](Collapse const &a, Collapse const &b) { return a.cost < b.cost; });
+
+        std::iota(remap.begin(), remap.end(), 0);
+        std::fill(touched.begin(), touched.end(), false);
+        usize triangleCount = result.size() / 3;
+        usize collapsed = 0;
+
+        for (auto const &collapse : collapses)
+        {
+            if (triangleCount * 3 <= targetIndexCount)
+            {
+                break;
+            }
+
+            if (collapse.bound > errorLimit || touched[collapse.from] || touched[collapse.to])
+            {
+                continue;
+            }
+
+            // Every vertex of `from` needs a vertex of `to` on its side of a seam.
+            bool valid = true;
+            for (uint32 v = vertexOffsets[collapse.from]; valid && v < vertexOffsets[collapse.from + 1]; v++)
+            {
+                uint32 const vertex = verticesOfPosition[v];
+                valid = !used[vertex] || counterparts.contains((static_cast<uint64>(vertex) << 32) | collapse.to);
+            }
+
+            // Triangles which stay must not flip.
+            glm::vec3 const target = uniquePositions[collapse.to];
+            usize removed = 0;
+            for (uint32 t = triangleOffsets[collapse.from]; valid && t < triangleOffsets[collapse.from + 1]; t++)
+            {
+                uint32 const triangle = trianglesOfPosition[t];
+                std::array<uint32, 3> const corners {positionOf[result[3 * triangle]], positionOf[result[3 * triangle + 1]],
+                                                     positionOf[result[3 * triangle + 2]]};
+                if (std::find(corners.begin(), corners.end(), collapse.to) != corners.end())
+                {
+                    removed++;
+                    continue;
+                }
+
+                std::array<glm::vec3, 3> before {};
+                std::array<glm::vec3, 3> after {};
+                for (usize corner = 0; corner < 3; corner++)
+                {
+                    before[corner] = uniquePositions[corners[corner]];
+                    after[corner] = corners[corner] == collapse.from ? target : before[corner];
+                }
+
+                glm::vec3 const normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 const normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                valid = glm::dot(normalBefore, normalAfter) > 0.f;
+            }
+
+            if (!valid)
+            {
+                continue;
+            }
+
+            for (uint32 v = vertexOffsets[collapse.from]; v < vertexOffsets[collapse.from + 1]; v++)
+            {
+                uint32 const vertex = verticesOfPosition[v];
+                if (used[vertex])
+                {
+                    remap[vertex] = counterparts.at((static_cast<uint64>(vertex) << 32) | collapse.to);
+                }
+            }
+
+            // Neighbours keep their triangles as they were checked until the next pass.
+            for (uint32 t = triangleOffsets[collapse.from]; t < triangleOffsets[collapse.from + 1]; t++)
+            {
+                uint32 const triangle = trianglesOfPosition[t];
+                for (usize corner = 0; corner < 3; corner++)
+                {
+                    touched[positionOf[result[3 * triangle + corner]]] = true;
+                }
+            }
+
+            quadrics[collapse.to] += quadrics[collapse.from];
+            bounds[collapse.to] += bounds[collapse.from];
+            error = std::max(error, static_cast<float>(std::sqrt(collapse.bound)));
+            triangleCount -= removed;
+            collapsed++;
+        }
+
+        if (collapsed == 0)
+        {
+            break;
+        }
+
+        usize kept = 0;
+        for (usize i = 0; i < result.size(); i += 3)
+        {
+            uint32 const a = remap[result[i]];
+            uint32 const b = remap[result[i + 1]];
+            uint32 const c = remap[result[i + 2]];
+            if (positionOf[a] == positionOf[b] || positionOf[b] == positionOf[c] || positionOf[c] == positionOf[a])
+            {
+                continue;
+            }
+
+            result[kept++] = a;
+            result[kept++] = b;
+            result[kept++] = c;
+        }
+        result.resize(kept);
+    }
+
+    return result;
+}
@@ -0,0 +1,131 @@
+#ifndef VULKAN_ENGINE_MESHOPTIMIZER_H
+#define VULKAN_ENGINE_MESHOPTIMIZER_H
+
+#include <span>
+#include <vector>
+
+#include "vulkan.h"
+
+namespace Engine::Vulkan
+{
+/**
+ * Reordering of indexed triangle lists for the GPU: post-transform vertex cache, overdraw, then vertex fetch.
+ *
+ * Every function works on indices only, the geometry itself is left to the caller.
+ */
+class MeshOptimizer
+{
+public:
+    /**
+     * Result of the simulation of a FIFO post-transform vertex cache.
+     */
+    struct CacheStatistics
+    {
+        // Average cache miss ratio: transformed vertices per triangle, 0.5 at best and 3 at worst.
+        float acmr = 0.f;
+        // Average transform to vertex ratio: transformed vertices per vertex, 1 at best.
+        float atvr = 0.f;
+    };
+
+    /**
+     * A cluster of triangles which are close to each other, with its bounds for culling.
+     */
+    struct Meshlet
+    {
+        // Ranges of `Meshlets::vertices` and of the triangles of `Meshlets::triangles`.
+        uint32 vertexOffset;
+        uint32 vertexCount;
+        uint32 triangleOffset;
+        uint32 triangleCount;
+
+        // Bounding sphere.
+        glm::vec3 center;
+        float radius;
+
+        // Normal cone: every triangle is back facing from `camera` when
+        // `dot(center - camera, coneAxis) >= coneCutoff * length(center - camera) + radius`.
+        glm::vec3 coneAxis;
+        float coneCutoff;
+    };
+    static_assert(std::is_standard_layout_v<Meshlet>);
+
+    struct Meshlets
+    {
+        std::vector<Meshlet> meshlets;
+        // Indices of the vertices of the mesh used by each meshlet.
+        std::vector<uint32> vertices;
+        // Three indices in the meshlet vertices per triangle.
+        std::vector<uint8> triangles;
+    };
+
+    // Close to the cache of current GPUs, whose real behaviour isn't FIFO anyway.
+    static constexpr uint32 defaultCacheSize = 16;
+
+    // Fit the output limits of mesh shaders on most devices, 124 triangles leave room for 4 bytes per triangle.
+    static constexpr uint32 maxMeshletVertices = 64;
+    static constexpr uint32 maxMeshletTriangles = 124;
+
+    MeshOptimizer() = delete;
+
+    [[nodiscard]] static CacheStatistics analyzeVertexCache(std::span<uint32 const> indices, usize vertexCount,
+                                                            uint32 cacheSize = defaultCacheSize);
+
+    /**
+     * Reorder triangles with Tipsify (Sander, Nehab and Barczak, 2007): triangles are emitted in fans around the
+     * vertex which is the most likely to still be in the cache.
+     *
+     * @param clusters Filled with the index, in triangles, of the first triangle of each cluster: a new cluster starts
+     * whenever Tipsify has to jump away from the current neighbourhood.
+     */
+    [[nodiscard]] static std::vector<uint32> optimizeVertexCache(std::span<uint32 const> indices, usize vertexCount,
+                                                                 std::vector<uint32> &clusters,
+                                                                 uint32 cacheSize = defaultCacheSize);
+
+    /**
+     * Reorder the clusters of a cache optimized list so that those facing away from the center of the mesh, the most
+     * likely to occlude the others, are drawn first. Clusters are split first wherever it keeps the cache miss ratio
+     * under `threshold` times the one of the whole list.
+     */
+    [[nodiscard]] static std::vector<uint32> optimizeOverdraw(std::span<uint32 const> indices,
+                                                              std::span<glm::vec3 const> positions,
+                                                              std::span<uint32 const> clusters, float threshold = 1.05f,
+                                                              uint32 cacheSize = defaultCacheSize);
+
+    /**
+     * Number vertices in the order they are first used, so vertex memory is read sequentially.
+     *
+     * @return For each vertex its new index, `unusedVertex` for vertices no triangle references.
+     */
+    [[nodiscard]] static std::vector<uint32> vertexFetchRemap(std::span<uint32 const> indices, usize vertexCount);
+
+    static constexpr uint32 unusedVertex = ~0u;
+
+    /**
+     * Simplify with quadric error metrics (Garland and Heckbert, 1997). Edges are collapsed, cheapest first, onto one of
+     * their vertices so the result indexes the same vertices.
+     *
+     * Vertices are matched by position, `positions` has one per vertex but `indices` may use only some of them.
+     * Vertices on an open border only move along it, and a texture seam moves along itself, every side of it at once,
+     * so neither opens.
+     *
+     * @param targetError Largest distance, in model space, allowed between the result and the input surface.
+     * @param error Set to an upper bound of the distance between the result and the input surface: the distance from
+     * each remaining vertex to the plane of every triangle it replaces.
+     * @param lockedVertices Empty, or one per vertex: non zero for vertices which must not move, such as those shared
+     * with other parts of the mesh simplified separately. A position moves only if none of its vertices is locked.
+     */
+    [[nodiscard]] static std::vector<uint32> simplify(std::span<uint32 const> indices, std::span<glm::vec3 const> positions,
+                                                      usize targetIndexCount, float targetError, float &error,
+                                                      std::span<uint8 const> lockedVertices = {});
+
+    /**
+     * Split the triangles, in order, into meshlets of at most `maxVertices` vertices and `maxTriangles` triangles.
+     * Cache optimized indices give compact meshlets.
+     */
+    [[nodiscard]] static Meshlets buildMeshlets(std::span<uint32 const> indices, std::span<glm::vec3 const> positions,
+                                                uint32 maxVertices = maxMeshletVertices,
+                                                uint32 maxTriangles = maxMeshletTriangles);
+};
+}
+
+#endif //VULKAN_ENGINE_MESHOPTIMIZER_H
@@ -0,0 +1,170 @@
+#include "mipchain.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace Engine::Vulkan;
+
+namespace
+{
+constexpr usize texelSize = 4;
+
+float srgbToLinear(float value)
+{
+    return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+float linearToSrgb(float value)
+{
+    return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+}
+}
+
+uint32 MipChain::levelCount(VkExtent2D size)
+{
+    return static_cast<uint32>(std::bit_width(std::max(size.width, size.height)));
+}
+
+VkExtent2D MipChain::levelSize(VkExtent2D size, uint32 level)
+{
+    return {.width = std::max(size.width >> level, 1u), .height = std::max(size.height >> level, 1u)};
+}
+
+MipChain MipChain::generate(std::span<std::byte const> pixels, VkExtent2D size, bool srgb)
+{
+    // Decoding sRGB is the costly part, do it once per possible value.
+    std::array<float, 256> toLinear {};
+    for (usize i = 0; i < toLinear.size(); ++i)
+    {
+        auto const value = static_cast<float>(i) / 255.f;
+        toLinear[i] = srgb ? srgbToLinear(value) : value;
+    }
+
+    uint32 const levels = levelCount(size);
+
+    usize totalSize = 0;
+    for (uint32 level = 0; level < levels; ++level)
+    {
+        VkExtent2D const extent = levelSize(size, level);
+        totalSize += usize {extent.width} * extent.height * texelSize;
+    }
+
+    std::vector<std::byte> data(totalSize);
+    std::vector<VkBufferImageCopy> regions;
+    regions.reserve(levels);
+
+    std::copy(pixels.begin(), pixels.begin() + static_cast<std::ptrdiff_t>(usize {size.width} * size.height * texelSize), data.begin());
+
+    usize offset = 0;
+    for (uint32 level = 0; level < levels; ++level)
+    {
+        VkExtent2D const extent = levelSize(size, level);
+
+        regions.push_back(
+        {
+            .bufferOffset = offset,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+            .imageOffset = {.x = 0, .y = 0, .z = 0},
+            .imageExtent = {.width = extent.width, .height = extent.height, .depth = 1},
+        });
+
+        if (level + 1 == levels)
+        {
+            break;
+        }
+
+        std::byte const *source = data.data() + offset;
+        offset += usize {extent.width} * extent.height * texelSize;
+        std::byte *destination = data.data() + offset;
+        VkExtent2D const next = levelSize(size, level + 1);
+
+        for (uint32 y = 0; y < next.height; ++y)
+        {
+            for (uint32 x = 0; x < next.width; ++x)
+            {
+                // Odd sizes: the last row or column is averaged with itself.
+                std::array<usize, 2> const xs {std::min(2 * x, extent.width - 1), std::min(2 * x + 1, extent.width - 1)};
+                std::array<usize, 2> const ys {std::min(2 * y, extent.height - 1), std::min(2 * y + 1, extent.height - 1)};
+
+                for (usize channel = 0; channel < texelSize; ++channel)
+                {
+                    // Alpha is always linear.
+                    bool const linear = channel == 3 || !srgb;
+
+                    float sum = 0.f;
+                    for (usize sy : ys)
+                    {
+                        for (usize sx : xs)
+                        {
+                            auto const value = std::to_integer<uint32>(source[(sy * extent.width + sx) * texelSize + channel]);
+                            sum += linear ? static_cast<float>(value) / 255.f : toLinear[value];
+                        }
+                    }
+
+                    float average = sum / 4.f;
+                    if (!linear)
+                    {
+                        average = linearToSrgb(average);
+                    }
+
+                    destination[(usize {y} * next.width + x) * texelSize + channel] =
+                    static_cast<std::byte>(std::clamp(std::lround(average * 255.f), 0l, 255l));
+                }
+            }
+        }
+    }
+
+    return MipChain(std::move(data), std::move(regions));
+}
+
+MipChain::MipChain(std::vector<std::byte> &&data, std::vector<VkBufferImageCopy> &&regions) :
+_data(std::move(data)),
+_regions(std::move(regions))
+{}
+
+std::span<std::byte const> MipChain::data() const
+{
+    return _data;
+}
+
+std::span<VkBufferImageCopy const> MipChain::regions() const
+{
+    return _regions;
+}
+
+std::vector<uint32> MipChain::maxDifferences(std::span<std::byte const> levels) const
+{
+    if (levels.size() < _data.size())
+    {
+        throw std::invalid_argument("Not enough texels to compare to the mip chain.");
+    }
+
+    std::vector<uint32> differences(_regions.size(), 0);
+    for (usize level = 0; level < _regions.size(); ++level)
+    {
+        VkBufferImageCopy const &region = _regions[level];
+        usize const begin = region.bufferOffset;
+        usize const end = begin + usize {region.imageExtent.width} * region.imageExtent.height * texelSize;
+
+        for (usize i = begin; i < end; ++i)
+        {
+            auto const expected = std::to_integer<int32>(_data[i]);
+            auto const actual = std::to_integer<int32>(levels[i]);
+            differences[level] = std::max(differences[level], static_cast<uint32>(std::abs(expected - actual)));
+        }
+    }
+
+    return differences;
+}
@@ -0,0 +1,57 @@
+#ifndef VULKAN_ENGINE_MIPCHAIN_H
+#define VULKAN_ENGINE_MIPCHAIN_H
+
+#include <span>
+#include <vector>
+
+#include "vulkan.h"
+
+namespace Engine::Vulkan
+{
+/**
+ * Every mip level of a 2D RGBA8 image, generated on the CPU with a 2x2 box filter.
+ *
+ * It is the fallback for formats the device can't blit with linear filtering, and the reference the device generated
+ * chains are expected to match.
+ */
+class MipChain : public OnlyMovable
+{
+public:
+    /**
+     * Number of levels of a full chain, down to 1x1.
+     */
+    [[nodiscard]] static uint32 levelCount(VkExtent2D size);
+    [[nodiscard]] static VkExtent2D levelSize(VkExtent2D size, uint32 level);
+
+    /**
+     * @param pixels Tightly packed RGBA8 texels of the first level.
+     * @param srgb Whether texels are sRGB encoded, in which case they are averaged in linear space.
+     */
+    [[nodiscard]] static MipChain generate(std::span<std::byte const> pixels, VkExtent2D size, bool srgb);
+
+    MipChain(MipChain &&) noexcept = default;
+    MipChain &operator=(MipChain &&) noexcept = default;
+
+    /**
+     * Texels of every level, one after the other.
+     */
+    [[nodiscard]] std::span<std::byte const> data() const;
+    /**
+     * One copy region per level, offsets relative to `data()`.
+     */
+    [[nodiscard]] std::span<VkBufferImageCopy const> regions() const;
+    /**
+     * Largest difference of a channel between each level and the same level of `levels`, laid out as `data()`,
+     * typically read back from a chain the device generated.
+     */
+    [[nodiscard]] std::vector<uint32> maxDifferences(std::span<std::byte const> levels) const;
+
+private:
+    MipChain(std::vector<std::byte> &&data, std::vector<VkBufferImageCopy> &&regions);
+
+    std::vector<std::byte> _data;
+    std::vector<VkBufferImageCopy> _regions;
+};
+}
+
+#endif //VULKAN_ENGINE_MIPCHAIN_H
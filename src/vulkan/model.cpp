@@ -1,24 +1,474 @@
 #include "model.h"
 
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <glm/gtc/packing.hpp>
+#include <limits>
+#include <numeric>
+#include <thread>
 #include <tiny_obj_loader.h>
+#include <unordered_map>
+
+#include "meshoptimizer.h"
+#include "../misc/threadpool.h"
 
 using namespace Engine::Vulkan;
 
-namespace std
+namespace
+{
+// Bump the version when the layout of the file, of `Model::Vertex`, or the meaning of a field changes.
+constexpr std::array<char, 8> binaryMagic {'V', 'E', 'M', 'E', 'S', 'H', '0', '7'};
+
+/**
+ * Header of binary mesh files, followed by the vertices, the indices, the levels of detail, the submeshes, the submesh
+ * ranges, the meshlets, the meshlet vertices, the meshlet triangles then the buffer content.
+ */
+struct BinaryHeader
 {
-template<>
-struct hash<Model::Vertex>
+    std::array<char, 8> magic;
+    // The OBJ file the mesh was made from, when it was.
+    uint64 sourceSize;
+    int64 sourceTime;
+    uint32 vertexSize;
+    uint32 indexSize;
+    uint64 vertexCount;
+    uint64 indexCount;
+    // Whether the indices went through `optimize()`.
+    uint32 optimized;
+    uint32 meshletSize;
+    uint64 meshletCount;
+    uint64 meshletVertexCount;
+    uint64 meshletTriangleCount;
+    uint32 lodSize;
+    uint32 lodCount;
+    uint32 submeshSize;
+    uint32 submeshCount;
+    // The buffer content: vertices in `vertexFormat`, then indices of `bufferIndexSize` bytes.
+    uint32 vertexFormat;
+    uint32 bufferIndexSize;
+    uint64 bufferSize;
+    // Quantized positions are relative to that box.
+    glm::vec3 center;
+    glm::vec3 extent;
+    uint32 normalizedTexCoords;
+};
+
+/**
+ * Hash of the bit pattern of a vertex: every word is mixed in, then the result goes through the MurmurHash3
+ * finalizer, so nearby positions end up far apart.
+ */
+uint64 hashVertex(Model::Vertex const &vertex)
 {
-    size_t operator()(Model::Vertex const &vertex) const
+    static_assert(sizeof(Model::Vertex) % sizeof(uint32) == 0, "Vertices are hashed by 32 bits words.");
+
+    std::array<uint32, sizeof(Model::Vertex) / sizeof(uint32)> words {};
+    std::memcpy(words.data(), &vertex, sizeof(vertex));
+
+    uint64 hash = 0;
+    for (uint32 const word : words)
     {
-        return (hash<glm::vec3>()(vertex.pos) ^
-            (hash<glm::vec2>()(vertex.texCoord) << 1));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/**
+ * Open addressing table, with linear probing, from vertices to their index in a vertex array. Vertices are the same
+ * when their bit patterns are.
+ *
+ * It never grows: it is sized once for the largest number of vertices it may see.
+ */
+class VertexTable
+{
+public:
+    explicit VertexTable(usize maxVertexCount) :
+    // At most half full, so probe sequences stay short.
+    _slots(std::bit_ceil(std::max<usize>(2 * maxVertexCount, 16)), empty),
+    _mask(_slots.size() - 1)
+    {}
+
+    /**
+     * @return The index of `vertex` in `vertices`, where it is appended if it isn't yet.
+     */
+    uint32 insert(Model::Vertex const &vertex, std::vector<Model::Vertex> &vertices)
+    {
+        for (usize slot = hashVertex(vertex) & _mask;; slot = (slot + 1) & _mask)
+        {
+            uint32 &index = _slots[slot];
+            if (index == empty)
+            {
+                index = static_cast<uint32>(vertices.size());
+                vertices.push_back(vertex);
+                return index;
+            }
+
+            if (std::memcmp(&vertices[index], &vertex, sizeof(vertex)) == 0)
+            {
+                return index;
+            }
+        }
     }
+
+private:
+    static constexpr uint32 empty = ~0u;
+
+    std::vector<uint32> _slots;
+    usize _mask;
+};
+
+struct Geometry
+{
+    std::vector<Model::Vertex> vertices;
+    std::vector<uint32> indices;
+    // Material of each triangle, until they are grouped in submeshes.
+    std::vector<int32> materials;
 };
+
+std::vector<glm::vec3> positionsOf(std::span<Model::Vertex const> vertices)
+{
+    std::vector<glm::vec3> positions(vertices.size());
+    std::transform(vertices.begin(), vertices.end(), positions.begin(), [](Model::Vertex const &vertex) { return vertex.pos; });
+    return positions;
+}
+
+/**
+ * Sort triangles by material, so that shapes sharing a material become a single submesh.
+ *
+ * @param ranges Filled with the indices of each submesh.
+ */
+std::vector<Model::Submesh> groupByMaterial(Geometry &geometry, std::vector<Model::Range> &ranges)
+{
+    std::vector<uint32> order(geometry.materials.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&geometry](uint32 a, uint32 b)
+    {
+        return geometry.materials[a] < geometry.materials[b];
+    });
+
+    std::vector<uint32> indices;
+    indices.reserve(geometry.indices.size());
+    std::vector<Model::Submesh> submeshes;
+
+    for (usize i = 0; i < order.size();)
+    {
+        int32 const material = geometry.materials[order[i]];
+        Model::Submesh submesh
+        {
+            .material = material,
+            .min = glm::vec3(std::numeric_limits<float>::max()),
+            .max = glm::vec3(std::numeric_limits<float>::lowest()),
+        };
+        Model::Range range {.indexOffset = static_cast<uint32>(indices.size())};
+
+        for (; i < order.size() && geometry.materials[order[i]] == material; i++)
+        {
+            for (usize corner = 0; corner < 3; corner++)
+            {
+                uint32 const vertex = geometry.indices[3 * order[i] + corner];
+                indices.push_back(vertex);
+                submesh.min = glm::min(submesh.min, geometry.vertices[vertex].pos);
+                submesh.max = glm::max(submesh.max, geometry.vertices[vertex].pos);
+            }
+        }
+
+        range.indexCount = static_cast<uint32>(indices.size()) - range.indexOffset;
+        submeshes.push_back(submesh);
+        ranges.push_back(range);
+    }
+
+    geometry.indices = std::move(indices);
+    geometry.materials.clear();
+
+    return submeshes;
+}
+
+/**
+ * Append one simplified copy of the indices per ratio, each submesh on its own so that boundaries between materials
+ * stay where they are. Simplifications run in parallel.
+ *
+ * Submeshes which can't be simplified further keep their previous indices. Levels which can't be simplified further
+ * reuse the ranges of the previous one.
+ *
+ * @param ranges Indices of each submesh in the full resolution level, then appended with those of each new level.
+ * @return Every level, the full resolution one first.
+ */
+std::vector<Model::Lod> buildLods(Geometry &geometry, std::vector<Model::Range> &ranges, std::span<float const> ratios)
+{
+    auto const positions = positionsOf(geometry.vertices);
+    usize const submeshCount = ranges.size();
+
+    // Submeshes are simplified separately: the edges between two of them look like open borders to each, which would
+    // move them apart and open cracks. Positions used by more than one submesh stay where they are.
+    std::vector<uint8> locked;
+    if (submeshCount > 1)
+    {
+        locked.resize(positions.size(), 0);
+
+        // map<position, first submesh using it, or -1 once used by several>
+        std::unordered_map<glm::vec3, int64> owners;
+        for (usize submesh = 0; submesh < submeshCount; submesh++)
+        {
+            auto const indices = std::span(geometry.indices).subspan(ranges[submesh].indexOffset, ranges[submesh].indexCount);
+            for (uint32 const index : indices)
+            {
+                auto const [owner, inserted] = owners.try_emplace(positions[index], static_cast<int64>(submesh));
+                if (!inserted && owner->second != static_cast<int64>(submesh))
+                {
+                    owner->second = -1;
+                }
+            }
+        }
+
+        for (usize vertex = 0; vertex < positions.size(); vertex++)
+        {
+            auto const owner = owners.find(positions[vertex]);
+            locked[vertex] = owner != owners.end() && owner->second == -1;
+        }
+    }
+
+    // Every level is simplified from the full resolution one, so errors are measured against it.
+    usize const taskCount = ratios.size() * submeshCount;
+    std::vector<std::vector<uint32>> simplified(taskCount);
+    std::vector<float> errors(taskCount, 0.f);
+    auto const simplify = [&](usize task)
+    {
+        Model::Range const range = ranges[task % submeshCount];
+        auto const source = std::span(geometry.indices).subspan(range.indexOffset, range.indexCount);
+        auto const target = static_cast<usize>(static_cast<float>(range.indexCount) * ratios[task / submeshCount]) / 3 * 3;
+        simplified[task] = MeshOptimizer::simplify(source, positions, target, std::numeric_limits<float>::max(), errors[task],
+                                                   locked);
+    };
+
+    if (taskCount > 1)
+    {
+        auto threads = ThreadPool::create();
+
+        std::vector<std::future<void>> futures;
+        futures.reserve(taskCount);
+        for (usize task = 0; task < taskCount; task++)
+        {
+            futures.push_back(threads.submit([&simplify, task]() { simplify(task); }));
+        }
+
+        for (auto &future : futures)
+        {
+            future.get();
+        }
+    }
+    else if (taskCount == 1)
+    {
+        simplify(0);
+    }
+
+    std::vector<Model::Lod> lods
+    {
+        {.indexOffset = 0, .indexCount = static_cast<uint32>(geometry.indices.size()), .error = 0.f, .ratio = 1.f},
+    };
+
+    for (usize level = 0; level < ratios.size(); level++)
+    {
+        usize const previous = lods.size() - 1;
+
+        usize indexCount = 0;
+        for (usize submesh = 0; submesh < submeshCount; submesh++)
+        {
+            auto &indices = simplified[level * submeshCount + submesh];
+            Model::Range const previousRange = ranges[previous * submeshCount + submesh];
+            if (indices.empty() || indices.size() >= previousRange.indexCount)
+            {
+                auto const begin = geometry.indices.begin() + previousRange.indexOffset;
+                indices.assign(begin, begin + previousRange.indexCount);
+            }
+            indexCount += indices.size();
+        }
+
+        if (indexCount >= lods.back().indexCount)
+        {
+            Model::Lod lod = lods.back();
+            lod.ratio = ratios[level];
+            lods.push_back(lod);
+            for (usize submesh = 0; submesh < submeshCount; submesh++)
+            {
+                ranges.push_back(ranges[previous * submeshCount + submesh]);
+            }
+            continue;
+        }
+
+        Model::Lod lod
+        {
+            .indexOffset = static_cast<uint32>(geometry.indices.size()),
+            .indexCount = static_cast<uint32>(indexCount),
+            .error = lods.back().error,
+            .ratio = ratios[level],
+        };
+        for (usize submesh = 0; submesh < submeshCount; submesh++)
+        {
+            auto const &indices = simplified[level * submeshCount + submesh];
+            ranges.push_back({
+                .indexOffset = static_cast<uint32>(geometry.indices.size()),
+                .indexCount = static_cast<uint32>(indices.size()),
+            });
+            lod.error = std::max(lod.error, errors[level * submeshCount + submesh]);
+            geometry.indices.insert(geometry.indices.end(), indices.begin(), indices.end());
+        }
+        lods.push_back(lod);
+    }
+
+    return lods;
+}
+
+/**
+ * Reorder triangles of each submesh range for the post-transform vertex cache then for overdraw, and vertices in fetch
+ * order.
+ */
+void optimize(Geometry &geometry, std::span<Model::Range const> ranges, std::span<Model::Lod const> lods,
+              std::string const &path)
+{
+    auto const fullResolution = [&]()
+    {
+        return std::span(geometry.indices).first(lods.front().indexCount);
+    };
+    auto const before = MeshOptimizer::analyzeVertexCache(fullResolution(), geometry.vertices.size());
+
+    auto const positions = positionsOf(geometry.vertices);
+    // New ranges come in order, those shared with a previous level point back.
+    usize optimizedEnd = 0;
+    for (auto const &range : ranges)
+    {
+        if (range.indexOffset < optimizedEnd || range.indexCount == 0)
+        {
+            continue;
+        }
+
+        auto const indices = std::span(geometry.indices).subspan(range.indexOffset, range.indexCount);
+        std::vector<uint32> clusters;
+        auto optimized = MeshOptimizer::optimizeVertexCache(indices, geometry.vertices.size(), clusters);
+        optimized = MeshOptimizer::optimizeOverdraw(optimized, positions, clusters);
+        std::copy(optimized.begin(), optimized.end(), indices.begin());
+
+        optimizedEnd = range.indexOffset + range.indexCount;
+    }
+
+    // The full resolution level comes first, its vertices are the first ones.
+    auto const remap = MeshOptimizer::vertexFetchRemap(geometry.indices, geometry.vertices.size());
+    std::vector<Model::Vertex> vertices(geometry.vertices.size());
+    usize usedCount = 0;
+    for (usize vertex = 0; vertex < remap.size(); vertex++)
+    {
+        if (remap[vertex] != MeshOptimizer::unusedVertex)
+        {
+            vertices[remap[vertex]] = geometry.vertices[vertex];
+            usedCount++;
+        }
+    }
+    vertices.resize(usedCount);
+
+    for (uint32 &index : geometry.indices)
+    {
+        index = remap[index];
+    }
+    geometry.vertices = std::move(vertices);
+
+    auto const after = MeshOptimizer::analyzeVertexCache(fullResolution(), geometry.vertices.size());
+    spdlog::debug("Optimized model '{}': ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}.", path, before.acmr, after.acmr,
+                  before.atvr, after.atvr);
+}
+
+/**
+ * Meshlets of the full resolution level, submesh after submesh so none mixes materials.
+ */
+MeshOptimizer::Meshlets buildMeshlets(Geometry const &geometry, std::span<Model::Range const> ranges,
+                                      std::span<Model::Submesh> submeshes)
+{
+    auto const positions = positionsOf(geometry.vertices);
+
+    MeshOptimizer::Meshlets meshlets;
+    for (usize submesh = 0; submesh < submeshes.size(); submesh++)
+    {
+        auto const indices = std::span(geometry.indices).subspan(ranges[submesh].indexOffset, ranges[submesh].indexCount);
+        auto part = MeshOptimizer::buildMeshlets(indices, positions);
+
+        submeshes[submesh].meshletOffset = static_cast<uint32>(meshlets.meshlets.size());
+        submeshes[submesh].meshletCount = static_cast<uint32>(part.meshlets.size());
+        for (auto meshlet : part.meshlets)
+        {
+            meshlet.vertexOffset += static_cast<uint32>(meshlets.vertices.size());
+            meshlet.triangleOffset += static_cast<uint32>(meshlets.triangles.size() / 3);
+            meshlets.meshlets.push_back(meshlet);
+        }
+        meshlets.vertices.insert(meshlets.vertices.end(), part.vertices.begin(), part.vertices.end());
+        meshlets.triangles.insert(meshlets.triangles.end(), part.triangles.begin(), part.triangles.end());
+    }
+
+    return meshlets;
+}
+
+Geometry deduplicate(tinyobj::attrib_t const &attrib, tinyobj::shape_t const &shape)
+{
+    Geometry geometry;
+    geometry.indices.reserve(shape.mesh.indices.size());
+    // Every index may be a new vertex.
+    VertexTable table(shape.mesh.indices.size());
+
+    for (auto const &index : shape.mesh.indices)
+    {
+        Model::Vertex vertex {};
+
+        vertex.pos = {
+            attrib.vertices[3 * index.vertex_index + 0],
+            attrib.vertices[3 * index.vertex_index + 1],
+            attrib.vertices[3 * index.vertex_index + 2]
+        };
+
+        vertex.texCoord = {
+            attrib.texcoords[2 * index.texcoord_index + 0],
+            1.f - attrib.texcoords[2 * index.texcoord_index + 1]
+        };
+
+        geometry.indices.push_back(table.insert(vertex, geometry.vertices));
+    }
+
+    // Faces are triangulated, -1 is no material.
+    geometry.materials.assign(shape.mesh.material_ids.begin(), shape.mesh.material_ids.end());
+    geometry.materials.resize(geometry.indices.size() / 3, -1);
+
+    return geometry;
+}
+}
+
+Model Model::createFromFile(std::string const &path, bool optimize, VertexFormat format, std::span<float const> lodRatios)
+{
+    std::filesystem::path const source = path;
+    std::filesystem::path binary = source;
+    binary += ".mesh";
+
+    if (auto model = createFromBinaryFile(binary, source, optimize, format, lodRatios))
+    {
+        return std::move(*model);
+    }
+
+    auto model = createFromObjFile(path, optimize, lodRatios);
+    model.setFormat(format);
+    model.writeBinaryFile(binary, source, optimize);
+
+    return model;
 }
 
-Model Model::createFromFile(std::string const &path)
+Model Model::createFromObjFile(std::string const &path, bool optimize, std::span<float const> lodRatios)
 {
+    auto const start = std::chrono::steady_clock::now();
+
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> shapes;
     std::vector<tinyobj::material_t> materials;
@@ -29,56 +479,141 @@ Model Model::createFromFile(std::string const &path)
         throw std::runtime_error(warn + err);
     }
 
-    std::unordered_map<Vertex, uint32_t> uniqueVertices;
-    std::vector<Vertex> vertices;
-    std::vector<uint32> indices;
-    for (const auto &shape : shapes)
+    // Shapes are deduplicated independently, in parallel, then merged.
+    std::vector<Geometry> geometries;
+    geometries.reserve(shapes.size());
+
+    if (shapes.size() > 1)
     {
-        for (const auto &index : shape.mesh.indices)
+        auto threads = ThreadPool::create();
+
+        std::vector<std::future<Geometry>> futures;
+        futures.reserve(shapes.size());
+        for (auto const &shape : shapes)
         {
-            Vertex vertex {};
+            futures.push_back(threads.submit([&attrib, &shape]() { return deduplicate(attrib, shape); }));
+        }
 
-            vertex.pos = {
-                attrib.vertices[3 * index.vertex_index + 0],
-                attrib.vertices[3 * index.vertex_index + 1],
-                attrib.vertices[3 * index.vertex_index + 2]
-            };
+        for (auto &future : futures)
+        {
+            geometries.push_back(future.get());
+        }
+    }
+    else if (!shapes.empty())
+    {
+        geometries.push_back(deduplicate(attrib, shapes.front()));
+    }
 
-            vertex.texCoord = {
-                attrib.texcoords[2 * index.texcoord_index + 0],
-                1.f - attrib.texcoords[2 * index.texcoord_index + 1]
-            };
+    Geometry merged;
+    auto &[vertices, indices, triangleMaterials] = merged;
 
-            if (uniqueVertices.count(vertex) == 0)
+    if (geometries.size() == 1)
+    {
+        merged = std::move(geometries.front());
+    }
+    else
+    {
+        // Shapes may share vertices: only the unique vertices of each shape are looked up again.
+        usize vertexCount = 0;
+        usize indexCount = 0;
+        for (auto const &geometry : geometries)
+        {
+            vertexCount += geometry.vertices.size();
+            indexCount += geometry.indices.size();
+        }
+
+        VertexTable table(vertexCount);
+        vertices.reserve(vertexCount);
+        indices.reserve(indexCount);
+        triangleMaterials.reserve(indexCount / 3);
+
+        std::vector<uint32> remap;
+        for (auto const &geometry : geometries)
+        {
+            remap.clear();
+            for (auto const &vertex : geometry.vertices)
             {
-                uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-                vertices.push_back(vertex);
+                remap.push_back(table.insert(vertex, vertices));
             }
 
-            indices.push_back(uniqueVertices[vertex]);
+            for (uint32 const index : geometry.indices)
+            {
+                indices.push_back(remap[index]);
+            }
+            triangleMaterials.insert(triangleMaterials.end(), geometry.materials.begin(), geometry.materials.end());
         }
     }
 
-    spdlog::debug("Loaded model '{}'.", path);
-    return Model(std::move(vertices), std::move(indices));
+    double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // Every index is a vertex of the OBJ faces, before deduplication.
+    spdlog::debug("Loaded model '{}': {} vertices, {} unique, in {:.3f}s ({:.0f} vertices/s).", path, indices.size(),
+                  vertices.size(), seconds, static_cast<double>(indices.size()) / std::max(seconds, 1e-9));
+
+    std::vector<Range> ranges;
+    auto submeshes = groupByMaterial(merged, ranges);
+    for (usize submesh = 0; submesh < submeshes.size(); submesh++)
+    {
+        auto const material = static_cast<usize>(submeshes[submesh].material);
+        spdlog::debug("Model '{}' submesh {}: material '{}', {} triangles.", path, submesh,
+                      material < materials.size() ? materials[material].name : "", ranges[submesh].indexCount / 3);
+    }
+
+    auto lods = buildLods(merged, ranges, lodRatios);
+    for (usize level = 1; level < lods.size(); level++)
+    {
+        spdlog::debug("Model '{}' level {}: {} triangles, error {:.4g}.", path, level, lods[level].indexCount / 3,
+                      lods[level].error);
+    }
+
+    if (optimize)
+    {
+        ::optimize(merged, ranges, lods, path);
+    }
+
+    auto meshlets = buildMeshlets(merged, ranges, submeshes);
+    spdlog::debug("Built {} meshlets for model '{}'.", meshlets.meshlets.size(), path);
+
+    return Model(std::move(vertices), std::move(indices), std::move(lods), std::move(submeshes), std::move(ranges),
+                 std::move(meshlets));
 }
 
-VkVertexInputBindingDescription Model::bindingDescription()
+VkVertexInputBindingDescription Model::bindingDescription() const
 {
     VkVertexInputBindingDescription bindingDescription
     {
         .binding = 0,
-        .stride = sizeof(Vertex),
+        .stride = static_cast<uint32>(vertexSize()),
         .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
     };
 
     return bindingDescription;
 }
 
-std::vector<VkVertexInputAttributeDescription> Model::attributesDescriptions()
+std::vector<VkVertexInputAttributeDescription> Model::attributesDescriptions() const
 {
     std::vector<VkVertexInputAttributeDescription> attributesDescriptions {};
 
+    if (_format == VertexFormat::Quantized)
+    {
+        attributesDescriptions.push_back(
+        {
+            .location = 0,
+            .binding = 0,
+            .format = VK_FORMAT_R16G16B16A16_SNORM,
+            .offset = offsetof(QuantizedVertex, pos),
+        });
+
+        attributesDescriptions.push_back(
+        {
+            .location = 1,
+            .binding = 0,
+            .format = _normalizedTexCoords ? VK_FORMAT_R16G16_UNORM : VK_FORMAT_R16G16_SFLOAT,
+            .offset = offsetof(QuantizedVertex, texCoord),
+        });
+
+        return attributesDescriptions;
+    }
+
     attributesDescriptions.push_back(
     {
         .location = 0,
@@ -98,42 +633,215 @@ std::vector<VkVertexInputAttributeDescription> Model::attributesDescriptions()
     return attributesDescriptions;
 }
 
-Model::Model(std::vector<Vertex> &&vertices, std::vector<uint32> &&indices) :
-_vertices(std::move(vertices)),
-_indices(std::move(indices))
+glm::mat4 Model::dequantization() const
 {
+    if (_format != VertexFormat::Quantized)
+    {
+        return glm::mat4(1.f);
+    }
 
+    return glm::scale(glm::translate(glm::mat4(1.f), _center), _extent);
 }
 
-Buffer Model::toBuffer(not_null<LogicalDevice*> device, CommandPool &commandPool)
+std::optional<Model> Model::createFromBinaryFile(std::filesystem::path const &path, std::filesystem::path const &source,
+                                                 bool optimized, VertexFormat format, std::span<float const> lodRatios)
 {
-    usize verticesSize = sizeof(decltype(_vertices)::value_type) * _vertices.size();
-    usize indicesSize = sizeof(decltype(_indices)::value_type) * _indices.size();
-    // Copy vertices then into the same buffer
-    VkDeviceSize bufferSize = verticesSize + indicesSize;
+    std::error_code error;
+    if (!std::filesystem::exists(path, error))
+    {
+        return std::nullopt;
+    }
 
-    auto stagingBuffer = Buffer::create(device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, bufferSize,
-    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    auto file = MappedFile::create(path);
+    auto const bytes = file.data();
 
+    BinaryHeader header {};
+    if (bytes.size() < sizeof(header))
     {
-        void *data = nullptr;
-        stagingBuffer.map(&data);
+        return std::nullopt;
+    }
+    std::memcpy(&header, bytes.data(), sizeof(header));
+
+    auto const sourceSize = std::filesystem::file_size(source, error);
+    auto const sourceTime = std::filesystem::last_write_time(source, error);
+    if (error)
+    {
+        return std::nullopt;
+    }
+
+    usize const verticesSize = header.vertexCount * sizeof(Vertex);
+    usize const indicesSize = header.indexCount * sizeof(uint32);
+    usize const lodsSize = header.lodCount * sizeof(Lod);
+    usize const submeshesSize = header.submeshCount * sizeof(Submesh);
+    usize const rangesSize = header.lodCount * header.submeshCount * sizeof(Range);
+    usize const meshletsSize = header.meshletCount * sizeof(MeshOptimizer::Meshlet);
+    usize const meshletVerticesSize = header.meshletVertexCount * sizeof(uint32);
+    usize const meshletTrianglesSize = header.meshletTriangleCount * 3 * sizeof(uint8);
 
-        memcpy(data, _vertices.data(), verticesSize);
-        memcpy(reinterpret_cast<uint8*>(data) + verticesSize, _indices.data(), indicesSize);
+    // The buffer layout only depends on the format and the vertex count.
+    usize const bufferVertexSize = format == VertexFormat::Quantized ? sizeof(QuantizedVertex) : sizeof(Vertex);
+    usize const bufferIndexSize = header.vertexCount <= std::numeric_limits<uint16>::max() + usize {1} ? sizeof(uint16) : sizeof(uint32);
+    usize const bufferSize = header.vertexCount * bufferVertexSize + header.indexCount * bufferIndexSize;
+
+    if (header.magic != binaryMagic || header.vertexSize != sizeof(Vertex) || header.indexSize != sizeof(uint32) ||
+        header.optimized != static_cast<uint32>(optimized) || header.meshletSize != sizeof(MeshOptimizer::Meshlet) ||
+        header.lodSize != sizeof(Lod) || header.lodCount != lodRatios.size() + 1 || header.submeshSize != sizeof(Submesh) ||
+        header.sourceSize != sourceSize || header.sourceTime != sourceTime.time_since_epoch().count() ||
+        header.vertexFormat != static_cast<uint32>(format) || header.bufferIndexSize != bufferIndexSize ||
+        header.bufferSize != bufferSize ||
+        bytes.size() < sizeof(header) + verticesSize + indicesSize + lodsSize + submeshesSize + rangesSize + meshletsSize +
+        meshletVerticesSize + meshletTrianglesSize + bufferSize)
+    {
+        spdlog::debug("Binary mesh '{}' is outdated.", path.string());
+        return std::nullopt;
+    }
+
+    // Every array is 4 bytes aligned in the file, and the mapping is page aligned.
+    auto const *cursor = bytes.data() + sizeof(header);
+    auto const *vertices = reinterpret_cast<Vertex const *>(cursor);
+    auto const *indices = reinterpret_cast<uint32 const *>(cursor += verticesSize);
+    auto const *lods = reinterpret_cast<Lod const *>(cursor += indicesSize);
+    auto const *submeshes = reinterpret_cast<Submesh const *>(cursor += lodsSize);
+    auto const *ranges = reinterpret_cast<Range const *>(cursor += submeshesSize);
+    auto const *meshlets = reinterpret_cast<MeshOptimizer::Meshlet const *>(cursor += rangesSize);
+    auto const *meshletVertices = reinterpret_cast<uint32 const *>(cursor += meshletsSize);
+    auto const *meshletTriangles = reinterpret_cast<uint8 const *>(cursor += meshletVerticesSize);
+    auto const *bufferData = cursor += meshletTrianglesSize;
+
+    // Levels made for other ratios.
+    for (usize level = 0; level < lodRatios.size(); level++)
+    {
+        if (lods[level + 1].ratio != lodRatios[level])
+        {
+            spdlog::debug("Binary mesh '{}' is outdated.", path.string());
+            return std::nullopt;
+        }
+    }
 
-        stagingBuffer.unmap();
+    spdlog::debug("Loaded model '{}'.", path.string());
+    Model model(std::move(file), {vertices, header.vertexCount}, {indices, header.indexCount}, {lods, header.lodCount},
+                {submeshes, header.submeshCount}, {ranges, header.lodCount * header.submeshCount},
+                {meshlets, header.meshletCount}, {meshletVertices, header.meshletVertexCount},
+                {meshletTriangles, header.meshletTriangleCount * 3}, {bufferData, bufferSize});
+    model._format = format;
+    model._center = header.center;
+    model._extent = header.extent;
+    model._normalizedTexCoords = header.normalizedTexCoords != 0;
+
+    return model;
+}
+
+void Model::writeBinaryFile(std::filesystem::path const &path, std::filesystem::path const &source, bool optimized) const
+{
+    std::error_code error;
+    auto const sourceSize = std::filesystem::file_size(source, error);
+    auto const sourceTime = std::filesystem::last_write_time(source, error);
+    if (error)
+    {
+        return;
+    }
+
+    BinaryHeader const header
+    {
+        .magic = binaryMagic,
+        .sourceSize = sourceSize,
+        .sourceTime = static_cast<int64>(sourceTime.time_since_epoch().count()),
+        .vertexSize = sizeof(Vertex),
+        .indexSize = sizeof(uint32),
+        .vertexCount = _vertices.size(),
+        .indexCount = _indices.size(),
+        .optimized = optimized,
+        .meshletSize = sizeof(MeshOptimizer::Meshlet),
+        .meshletCount = _meshlets.size(),
+        .meshletVertexCount = _meshletVertices.size(),
+        .meshletTriangleCount = _meshletTriangles.size() / 3,
+        .lodSize = sizeof(Lod),
+        .lodCount = static_cast<uint32>(_lods.size()),
+        .submeshSize = sizeof(Submesh),
+        .submeshCount = static_cast<uint32>(_submeshes.size()),
+        .vertexFormat = static_cast<uint32>(_format),
+        .bufferIndexSize = static_cast<uint32>(indexSize()),
+        .bufferSize = _bufferData.size(),
+        .center = _center,
+        .extent = _extent,
+        .normalizedTexCoords = _normalizedTexCoords,
+    };
+
+    // Write aside then rename, so a reader never sees a partial file.
+    std::filesystem::path temporary = path;
+    temporary += fmt::format(".{}.tmp", std::hash<std::thread::id> {}(std::this_thread::get_id()));
+
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            spdlog::warn("Can not write binary mesh '{}'.", path.string());
+            return;
+        }
+
+        file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+        file.write(reinterpret_cast<char const *>(_vertices.data()), static_cast<std::streamsize>(_vertices.size_bytes()));
+        file.write(reinterpret_cast<char const *>(_indices.data()), static_cast<std::streamsize>(_indices.size_bytes()));
+        file.write(reinterpret_cast<char const *>(_lods.data()), static_cast<std::streamsize>(_lods.size_bytes()));
+        file.write(reinterpret_cast<char const *>(_submeshes.data()), static_cast<std::streamsize>(_submeshes.size_bytes()));
+        file.write(reinterpret_cast<char const *>(_submeshRanges.data()), static_cast<std::streamsize>(_submeshRanges.size_bytes()));
+        file.write(reinterpret_cast<char const *>(_meshlets.data()), static_cast<std::streamsize>(_meshlets.size_bytes()));
+        file.write(reinterpret_cast<char const *>(_meshletVertices.data()), static_cast<std::streamsize>(_meshletVertices.size_bytes()));
+        file.write(reinterpret_cast<char const *>(_meshletTriangles.data()), static_cast<std::streamsize>(_meshletTriangles.size_bytes()));
+        file.write(reinterpret_cast<char const *>(_bufferData.data()), static_cast<std::streamsize>(_bufferData.size_bytes()));
+    }
+
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+    {
+        spdlog::warn("Can not write binary mesh '{}': {}.", path.string(), error.message());
+        std::filesystem::remove(temporary, error);
     }
+}
+
+Model::Model(std::vector<Vertex> &&vertices, std::vector<uint32> &&indices, std::vector<Lod> &&lods,
+             std::vector<Submesh> &&submeshes, std::vector<Range> &&submeshRanges, MeshOptimizer::Meshlets &&meshlets) :
+_ownedVertices(std::move(vertices)),
+_ownedIndices(std::move(indices)),
+_ownedLods(std::move(lods)),
+_ownedSubmeshes(std::move(submeshes)),
+_ownedSubmeshRanges(std::move(submeshRanges)),
+_ownedMeshlets(std::move(meshlets)),
+_vertices(_ownedVertices),
+_indices(_ownedIndices),
+_lods(_ownedLods),
+_submeshes(_ownedSubmeshes),
+_submeshRanges(_ownedSubmeshRanges),
+_meshlets(_ownedMeshlets.meshlets),
+_meshletVertices(_ownedMeshlets.vertices),
+_meshletTriangles(_ownedMeshlets.triangles)
+{}
+
+Model::Model(MappedFile &&file, std::span<Vertex const> vertices, std::span<uint32 const> indices,
+             std::span<Lod const> lods, std::span<Submesh const> submeshes, std::span<Range const> submeshRanges,
+             std::span<MeshOptimizer::Meshlet const> meshlets, std::span<uint32 const> meshletVertices,
+             std::span<uint8 const> meshletTriangles, std::span<std::byte const> bufferData) :
+_file(std::move(file)),
+_vertices(vertices),
+_indices(indices),
+_lods(lods),
+_submeshes(submeshes),
+_submeshRanges(submeshRanges),
+_meshlets(meshlets),
+_meshletVertices(meshletVertices),
+_meshletTriangles(meshletTriangles),
+_bufferData(bufferData)
+{}
 
+Buffer Model::toBuffer(not_null<LogicalDevice*> device, UploadService &uploads)
+{
+    // Vertices then indices, in the same buffer
     auto buffer = Buffer::create(device,
-                                 VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
-                                 bufferSize, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                                 _bufferData.size(), DeviceAllocator::MemoryUsage::GpuOnly);
 
-    auto cmdBuffer = CommandBuffer::create(device, &commandPool);
-    cmdBuffer.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-    Buffer::cmdCopy(cmdBuffer, buffer, stagingBuffer, bufferSize);
-    cmdBuffer.end();
-    cmdBuffer.submit(true);
+    // Straight from the mapped file when loaded from a binary mesh.
+    uploads.uploadToBuffer(buffer, _bufferData, 0);
 
     return buffer;
 }
@@ -145,7 +853,57 @@ usize Model::verticesOffset()
 
 usize Model::indexesOffset()
 {
-    return sizeof(decltype(_vertices)::value_type) * _vertices.size();
+    return vertexSize() * _vertices.size();
+}
+
+std::span<Model::Lod const> Model::lods() const
+{
+    return _lods;
+}
+
+usize Model::selectLod(float distance, float projectionScale, float pixelThreshold) const
+{
+    // The coarsest level which is still accurate enough. Inside the model, only the full resolution is.
+    for (usize level = _lods.size() - 1; level > 0; level--)
+    {
+        if (distance > 0.f && _lods[level].error * projectionScale / distance <= pixelThreshold)
+        {
+            return level;
+        }
+    }
+
+    return 0;
+}
+
+std::span<Model::Submesh const> Model::submeshes() const
+{
+    return _submeshes;
+}
+
+Model::Range Model::submeshRange(usize level, usize submesh) const
+{
+    return _submeshRanges[level * _submeshes.size() + submesh];
+}
+
+std::span<MeshOptimizer::Meshlet const> Model::meshlets() const
+{
+    return _meshlets;
+}
+
+std::span<uint32 const> Model::meshletVertices() const
+{
+    return _meshletVertices;
+}
+
+std::span<uint8 const> Model::meshletTriangles() const
+{
+    return _meshletTriangles;
+}
+
+VkIndexType Model::indexType() const
+{
+    // Every index fits in 16 bits.
+    return _vertices.size() <= std::numeric_limits<uint16>::max() + usize {1} ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
 }
 
 usize Model::indiceSize()
@@ -153,6 +911,105 @@ usize Model::indiceSize()
     return _indices.size();
 }
 
+void Model::setFormat(VertexFormat format)
+{
+    _format = format;
+
+    usize const verticesSize = vertexSize() * _vertices.size();
+    _ownedBufferData.resize(verticesSize + indexSize() * _indices.size());
+    _bufferData = _ownedBufferData;
+
+    if (indexType() == VK_INDEX_TYPE_UINT16)
+    {
+        std::vector<uint16> const narrowed(_indices.begin(), _indices.end());
+        std::memcpy(_ownedBufferData.data() + verticesSize, narrowed.data(), narrowed.size() * sizeof(uint16));
+    }
+    else
+    {
+        std::memcpy(_ownedBufferData.data() + verticesSize, _indices.data(), _indices.size_bytes());
+    }
+
+    if (format != VertexFormat::Quantized || _vertices.empty())
+    {
+        std::memcpy(_ownedBufferData.data(), _vertices.data(), _vertices.size_bytes());
+        return;
+    }
+
+    glm::vec3 min(std::numeric_limits<float>::max());
+    glm::vec3 max(std::numeric_limits<float>::lowest());
+    _normalizedTexCoords = true;
+    for (auto const &vertex : _vertices)
+    {
+        min = glm::min(min, vertex.pos);
+        max = glm::max(max, vertex.pos);
+        _normalizedTexCoords = _normalizedTexCoords &&
+            glm::all(glm::greaterThanEqual(vertex.texCoord, glm::vec2(0.f))) &&
+            glm::all(glm::lessThanEqual(vertex.texCoord, glm::vec2(1.f)));
+    }
+
+    _center = (min + max) / 2.f;
+    // Flat models still need a scale which can be inverted.
+    _extent = glm::max((max - min) / 2.f, glm::vec3(std::numeric_limits<float>::min()));
+
+    auto const quantized = quantize();
+    std::memcpy(_ownedBufferData.data(), quantized.data(), verticesSize);
+}
+
+usize Model::vertexSize() const
+{
+    return _format == VertexFormat::Quantized ? sizeof(QuantizedVertex) : sizeof(Vertex);
+}
+
+usize Model::indexSize() const
+{
+    return indexType() == VK_INDEX_TYPE_UINT16 ? sizeof(uint16) : sizeof(uint32);
+}
+
+std::vector<Model::QuantizedVertex> Model::quantize() const
+{
+    std::vector<QuantizedVertex> quantized(_vertices.size());
+
+    // Largest difference between the vertices and what the device reads, for the report.
+    glm::vec3 posError(0.f);
+    float texCoordError = 0.f;
+
+    for (usize i = 0; i < _vertices.size(); i++)
+    {
+        auto const &vertex = _vertices[i];
+
+        glm::vec3 const normalized = glm::clamp((vertex.pos - _center) / _extent, -1.f, 1.f);
+        glm::ivec3 const pos(glm::round(normalized * 32767.f));
+        quantized[i].pos = {static_cast<int16>(pos.x), static_cast<int16>(pos.y), static_cast<int16>(pos.z), 0};
+
+        // SNORM decoding, as the device does.
+        glm::vec3 const decodedPos = _center + _extent * glm::max(glm::vec3(pos) / 32767.f, -1.f);
+        posError = glm::max(posError, glm::abs(decodedPos - vertex.pos));
+
+        for (glm::length_t c = 0; c < 2; c++)
+        {
+            float const texCoord = vertex.texCoord[c];
+            float decoded;
+            if (_normalizedTexCoords)
+            {
+                quantized[i].texCoord[c] = static_cast<uint16>(std::round(texCoord * 65535.f));
+                decoded = static_cast<float>(quantized[i].texCoord[c]) / 65535.f;
+            }
+            else
+            {
+                quantized[i].texCoord[c] = glm::packHalf1x16(texCoord);
+                decoded = glm::unpackHalf1x16(quantized[i].texCoord[c]);
+            }
+            texCoordError = std::max(texCoordError, std::abs(decoded - texCoord));
+        }
+    }
+
+    spdlog::debug("Quantized {} vertices: maximum position error ({:.3g}, {:.3g}, {:.3g}), maximum texture coordinates "
+                  "error {:.3g} ({}).", _vertices.size(), posError.x, posError.y, posError.z, texCoordError,
+                  _normalizedTexCoords ? "UNORM16" : "half");
+
+    return quantized;
+}
+
 bool Model::Vertex::operator==(const Vertex &other) const
 {
     return pos == other.pos && texCoord == other.texCoord;
@@ -2,6 +2,9 @@
 #define VULKAN_ENGINE_MODEL_H
 
 #include <array>
+#include <filesystem>
+#include <optional>
+#include <span>
 #include <vector>
 
 #include "vulkan.h"
@@ -9,6 +12,9 @@
 #include "logicaldevice.h"
 #include "commandpool.h"
 #include "commandbuffer.h"
+#include "meshoptimizer.h"
+#include "uploadservice.h"
+#include "../misc/mappedfile.h"
 
 namespace Engine::Vulkan
 {
@@ -29,26 +35,184 @@ public:
     };
     static_assert(std::is_standard_layout_v<Vertex>);
 
-    [[nodiscard]] static Model createFromFile(std::string const &path);
+    /**
+     * Layout of the vertices in the buffers made by `toBuffer()`. Vertices are always kept as `Vertex` in main memory,
+     * along with the content of the buffer.
+     */
+    enum class VertexFormat
+    {
+        // `Vertex`, 20 bytes.
+        Float,
+        // `QuantizedVertex`, 12 bytes.
+        Quantized,
+    };
+
+    /**
+     * Position as SNORM16 relative to the bounding box of the model, brought back by `dequantization()`. Texture
+     * coordinates as UNORM16 when they all are in [0, 1], half floats otherwise.
+     */
+    struct QuantizedVertex
+    {
+        // The fourth component is padding, three components 16 bits formats aren't widely supported.
+        std::array<int16, 4> pos;
+        std::array<uint16, 2> texCoord;
+    };
+    static_assert(sizeof(QuantizedVertex) == 12);
+
+    /**
+     * A level of detail: a range of the indices, all levels share the vertices.
+     */
+    struct Lod
+    {
+        uint32 indexOffset;
+        uint32 indexCount;
+        // Upper bound of the distance, in model space, between this level and the full resolution surface.
+        float error;
+        // Fraction of the full resolution triangles this level was made for.
+        float ratio;
+    };
+
+    static constexpr std::array<float, 3> defaultLodRatios {0.5f, 0.25f, 0.125f};
+
+    struct Range
+    {
+        uint32 indexOffset;
+        uint32 indexCount;
+    };
+
+    /**
+     * The triangles of every OBJ shape using one material.
+     */
+    struct Submesh
+    {
+        // Index in the materials of the OBJ file, -1 for triangles without material.
+        int32 material;
+        // Bounding box, in model space.
+        glm::vec3 min;
+        glm::vec3 max;
+        // Range of `meshlets()`.
+        uint32 meshletOffset;
+        uint32 meshletCount;
+    };
+
+    /**
+     * Load an OBJ file. The result is stored in a binary file next to it, `<path>.mesh`, which is memory mapped
+     * instead of parsing the OBJ file again as long as the OBJ file doesn't change. The file also holds the content of
+     * the buffer for `format`, so loading it converts nothing.
+     *
+     * @param optimize Whether to reorder triangles for the post-transform vertex cache and overdraw, and vertices for
+     * fetch locality.
+     * @param lodRatios Decreasing fractions of the triangles kept by each simplified level of detail.
+     */
+    [[nodiscard]] static Model createFromFile(std::string const &path, bool optimize = true,
+                                              VertexFormat format = VertexFormat::Float,
+                                              std::span<float const> lodRatios = defaultLodRatios);
 
     ~Model() = default;
     Model(Model &&) noexcept = default;
     Model &operator=(Model &&) noexcept = default;
 
-    [[nodiscard]] static VkVertexInputBindingDescription bindingDescription();
-    [[nodiscard]] static std::vector<VkVertexInputAttributeDescription> attributesDescriptions();
+    [[nodiscard]] VkVertexInputBindingDescription bindingDescription() const;
+    [[nodiscard]] std::vector<VkVertexInputAttributeDescription> attributesDescriptions() const;
+
+    /**
+     * Transformation from the positions read by the vertex shader to model space, to apply before the model matrix.
+     * Identity unless vertices are quantized.
+     */
+    [[nodiscard]] glm::mat4 dequantization() const;
 
     usize verticesOffset();
     usize indexesOffset();
     usize indiceSize();
+    /**
+     * 16 bits indices in the buffers made by `toBuffer()` whenever there are few enough vertices.
+     */
+    [[nodiscard]] VkIndexType indexType() const;
+
+    /**
+     * Levels of detail from the full resolution one, whose error is 0, to the coarsest.
+     */
+    [[nodiscard]] std::span<Lod const> lods() const;
+    /**
+     * The coarsest level whose error, projected on screen, is at most `pixelThreshold` pixels.
+     *
+     * @param distance From the camera to the model.
+     * @param projectionScale Pixels per unit at a distance of 1: viewport height / (2 tan(vertical fov / 2)).
+     * @return Index of the level in `lods()`.
+     */
+    [[nodiscard]] usize selectLod(float distance, float projectionScale, float pixelThreshold = 1.f) const;
 
-    Buffer toBuffer(not_null<LogicalDevice*> device, CommandPool &commandPool);
+    /**
+     * One per material, to be drawn one after the other out of the buffer made by `toBuffer()`.
+     */
+    [[nodiscard]] std::span<Submesh const> submeshes() const;
+    /**
+     * Indices of a submesh at a level of detail. Within a level, submeshes are in order.
+     */
+    [[nodiscard]] Range submeshRange(usize level, usize submesh) const;
+
+    /**
+     * Clusters of at most 64 vertices and 124 triangles of the full resolution level with their bounds, for culling
+     * finer than the whole model. Each submesh has its own.
+     * Meshlet vertices index `Model` vertices, meshlet triangles index meshlet vertices.
+     */
+    [[nodiscard]] std::span<MeshOptimizer::Meshlet const> meshlets() const;
+    [[nodiscard]] std::span<uint32 const> meshletVertices() const;
+    [[nodiscard]] std::span<uint8 const> meshletTriangles() const;
+
+    /**
+     * The vertices and indices are uploaded asynchronously: the buffer is usable once the next batch of `uploads` is
+     * complete. They are laid out when the model is loaded, uploading is a plain copy.
+     */
+    Buffer toBuffer(not_null<LogicalDevice*> device, UploadService &uploads);
 
 private:
-    Model(std::vector<Vertex> &&vertices, std::vector<uint32> &&indices);
+    Model(std::vector<Vertex> &&vertices, std::vector<uint32> &&indices, std::vector<Lod> &&lods,
+          std::vector<Submesh> &&submeshes, std::vector<Range> &&submeshRanges, MeshOptimizer::Meshlets &&meshlets);
+    Model(MappedFile &&file, std::span<Vertex const> vertices, std::span<uint32 const> indices, std::span<Lod const> lods,
+          std::span<Submesh const> submeshes, std::span<Range const> submeshRanges,
+          std::span<MeshOptimizer::Meshlet const> meshlets, std::span<uint32 const> meshletVertices,
+          std::span<uint8 const> meshletTriangles, std::span<std::byte const> bufferData);
+
+    VertexFormat _format = VertexFormat::Float;
+    // Bounding box of the positions, quantized positions are relative to it.
+    glm::vec3 _center {0.f};
+    glm::vec3 _extent {1.f};
+    bool _normalizedTexCoords = false;
+
+    // Geometry is either owned, or viewed in a mapped binary file. Moves keep the spans valid.
+    std::vector<Vertex> _ownedVertices;
+    std::vector<uint32> _ownedIndices;
+    std::vector<Lod> _ownedLods;
+    std::vector<Submesh> _ownedSubmeshes;
+    // For each level, the range of each submesh.
+    std::vector<Range> _ownedSubmeshRanges;
+    MeshOptimizer::Meshlets _ownedMeshlets;
+    // Vertices in `_format` then indices in `indexType()`, as `toBuffer()` uploads them.
+    std::vector<std::byte> _ownedBufferData;
+    std::optional<MappedFile> _file;
+
+    std::span<Vertex const> _vertices;
+    std::span<uint32 const> _indices;
+    std::span<Lod const> _lods;
+    std::span<Submesh const> _submeshes;
+    std::span<Range const> _submeshRanges;
+    std::span<MeshOptimizer::Meshlet const> _meshlets;
+    std::span<uint32 const> _meshletVertices;
+    std::span<uint8 const> _meshletTriangles;
+    std::span<std::byte const> _bufferData;
+
+    [[nodiscard]] static Model createFromObjFile(std::string const &path, bool optimize, std::span<float const> lodRatios);
+    [[nodiscard]] static std::optional<Model> createFromBinaryFile(std::filesystem::path const &path, std::filesystem::path const &source, bool optimized, VertexFormat format, std::span<float const> lodRatios);
+    void writeBinaryFile(std::filesystem::path const &path, std::filesystem::path const &source, bool optimized) const;
 
-    std::vector<Vertex> _vertices;
-    std::vector<uint32> _indices;
+    /**
+     * Lay the buffer content out for `format`.
+     */
+    void setFormat(VertexFormat format);
+    [[nodiscard]] usize vertexSize() const;
+    [[nodiscard]] usize indexSize() const;
+    [[nodiscard]] std::vector<QuantizedVertex> quantize() const;
 };
 }
 
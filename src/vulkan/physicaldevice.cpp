@@ -36,6 +36,12 @@ _surface(surface)
     discoverAndPopulateQueueFamilies();
     discoverAndPopulateSurfaceProperties();
     discoverIfDeviceExtensionsAreSupported();
+
+    if (_instance->isExtensionEnabled(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME))
+    {
+        _getMemoryProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(
+            vkGetInstanceProcAddr(*_instance, "vkGetPhysicalDeviceMemoryProperties2KHR"));
+    }
 }
 
 PhysicalDevice::operator VkPhysicalDevice() const
@@ -129,6 +135,7 @@ void PhysicalDevice::discoverIfDeviceExtensionsAreSupported()
     for (const auto &extension : availableExtensions)
     {
         requiredExtensions.erase(extension.extensionName);
+        _supportedExtensions.insert(extension.extensionName);
     }
 
     _areRequiredDeviceExtensionsSupported = requiredExtensions.empty();
@@ -187,6 +194,14 @@ VkPhysicalDeviceProperties PhysicalDevice::properties() const
     return _properties;
 }
 
+VkFormatProperties PhysicalDevice::formatProperties(VkFormat format) const
+{
+    VkFormatProperties properties {};
+    vkGetPhysicalDeviceFormatProperties(_physicalDevice, format, &properties);
+
+    return properties;
+}
+
 VkPhysicalDeviceFeatures PhysicalDevice::features() const
 {
     return _features;
@@ -196,3 +211,57 @@ VkPhysicalDeviceMemoryProperties PhysicalDevice::memories() const
 {
     return _memories;
 }
+
+std::optional<VkPhysicalDeviceMemoryBudgetPropertiesEXT> PhysicalDevice::memoryBudget() const
+{
+    if (!_getMemoryProperties2 || !isExtensionSupported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+    {
+        return std::nullopt;
+    }
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+    };
+    VkPhysicalDeviceMemoryProperties2KHR properties
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR,
+        .pNext = &budget,
+    };
+    _getMemoryProperties2(_physicalDevice, &properties);
+
+    return budget;
+}
+
+bool PhysicalDevice::isExtensionSupported(std::string_view extension) const
+{
+    return _supportedExtensions.contains(extension);
+}
+
+std::vector<char const *> PhysicalDevice::enabledExtensions() const
+{
+    std::vector<char const *> extensions(requiredDeviceExtensions.begin(), requiredDeviceExtensions.end());
+
+    for (auto const *extension : optionalDeviceExtensions)
+    {
+        bool hasDependencies = true;
+        if (std::string_view(extension) == VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)
+        {
+            // VK_EXT_memory_budget is only usable through VK_KHR_get_physical_device_properties2.
+            hasDependencies = _getMemoryProperties2 != nullptr;
+        }
+        else if (std::string_view(extension) == VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME)
+        {
+            // VK_KHR_dedicated_allocation requires VK_KHR_get_memory_requirements2, core since Vulkan 1.1.
+            hasDependencies = isExtensionSupported(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME) ||
+                              _properties.apiVersion >= VK_API_VERSION_1_1;
+        }
+
+        if (isExtensionSupported(extension) && hasDependencies)
+        {
+            extensions.push_back(extension);
+        }
+    }
+
+    return extensions;
+}
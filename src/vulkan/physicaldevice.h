@@ -3,6 +3,9 @@
 
 # include <array>
 # include <optional>
+# include <set>
+# include <string>
+# include <string_view>
 
 # include "vulkan.h"
 # include "instance.h"
@@ -21,6 +24,16 @@ public:
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,
     };
 
+    /**
+     * Extensions enabled when the device supports them. Check `isExtensionSupported()` before relying on one.
+     */
+    static constexpr std::array const optionalDeviceExtensions
+    {
+        VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME,
+        VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME,
+        VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+    };
+
     static constexpr std::array const requiredValidationLayers
     {
 #ifndef NDEBUG
@@ -73,6 +86,18 @@ public:
     [[nodiscard]] VkPhysicalDeviceProperties properties() const;
     [[nodiscard]] VkPhysicalDeviceFeatures features() const;
     [[nodiscard]] VkPhysicalDeviceMemoryProperties memories() const;
+    [[nodiscard]] VkFormatProperties formatProperties(VkFormat format) const;
+    /**
+     * Query the current budget and usage of every heap, for this process.
+     *
+     * @return `std::nullopt` if `VK_EXT_memory_budget` isn't enabled.
+     */
+    [[nodiscard]] std::optional<VkPhysicalDeviceMemoryBudgetPropertiesEXT> memoryBudget() const;
+    [[nodiscard]] bool isExtensionSupported(std::string_view extension) const;
+    /**
+     * Every required extension, plus the optional ones this device supports.
+     */
+    [[nodiscard]] std::vector<char const *> enabledExtensions() const;
 
 private:
     PhysicalDevice(not_null<VkPhysicalDevice> physicalDevice, not_null<Instance*> instance, not_null<SurfaceKHR*> surface);
@@ -87,6 +112,8 @@ private:
     VkPhysicalDeviceFeatures _features {};
     VkPhysicalDeviceMemoryProperties _memories {};
     bool _areRequiredDeviceExtensionsSupported = false;
+    std::set<std::string, std::less<>> _supportedExtensions;
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR _getMemoryProperties2 = nullptr;
 
     /**
      * Should return a score instead of a boolean to choose wisely the right GPU.
@@ -51,8 +51,17 @@ public:
     template <class VertexInput>
     void setVertexInputDescription()
     {
-        _vertexBindingDescription = VertexInput::bindingDescription();
-        _vertexAttributesDescriptions = VertexInput::attributesDescriptions();
+        setVertexInputDescription(VertexInput::bindingDescription(), VertexInput::attributesDescriptions());
+    }
+
+    /**
+     * For vertex layouts only known at runtime.
+     */
+    void setVertexInputDescription(VkVertexInputBindingDescription bindingDescription,
+                                   std::vector<VkVertexInputAttributeDescription> attributesDescriptions)
+    {
+        _vertexBindingDescription = bindingDescription;
+        _vertexAttributesDescriptions = std::move(attributesDescriptions);
 
         _vertexInputInfo = {};
         _vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -20,7 +20,8 @@ Sampler Sampler::create(not_null<LogicalDevice*> device)
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerInfo.mipLodBias = 0.f;
     samplerInfo.minLod = 0.f;
-    samplerInfo.maxLod = 0.f;
+    // Views decide how many levels are sampled.
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 
     VkSampler sampler = VK_NULL_HANDLE;
     ThrowError(vkCreateSampler(*device, &samplerInfo, nullptr, &sampler));
@@ -0,0 +1,177 @@
+#include "texturecache.h"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <thread>
+
+#include "../misc/mappedfile.h"
+
+using namespace Engine::Vulkan;
+
+namespace
+{
+// Bump the version when the layout of entries, or what is stored in them, changes.
+constexpr std::array<char, 8> magic {'V', 'E', 'T', 'E', 'X', 'C', '0', '1'};
+
+struct EntryHeader
+{
+    std::array<char, 8> magic;
+    uint64 sourceHash;
+    uint32 format;
+    uint32 tiling;
+    uint32 width;
+    uint32 height;
+    uint32 mipLevels;
+    uint32 usage;
+    uint32 regionCount;
+    uint32 padding;
+    uint64 dataSize;
+};
+
+// Regions follow the header, then the texels, aligned for a fast copy.
+constexpr usize dataAlignment = 16;
+
+usize dataOffset(usize regionCount)
+{
+    usize const offset = sizeof(EntryHeader) + regionCount * sizeof(VkBufferImageCopy);
+    return (offset + dataAlignment - 1) / dataAlignment * dataAlignment;
+}
+
+/**
+ * FNV-1a, fast enough compared to decoding and good enough to tell file versions apart.
+ */
+uint64 hash(std::span<std::byte const> bytes)
+{
+    uint64 value = 0xcbf29ce484222325;
+    for (std::byte const byte : bytes)
+    {
+        value ^= std::to_integer<uint64>(byte);
+        value *= 0x100000001b3;
+    }
+
+    return value;
+}
+}
+
+TextureCache TextureCache::create(std::filesystem::path directory)
+{
+    std::filesystem::create_directories(directory);
+
+    return TextureCache(std::move(directory));
+}
+
+TextureCache::TextureCache(std::filesystem::path &&directory) :
+_directory(std::move(directory))
+{}
+
+TextureData TextureCache::load(not_null<LogicalDevice *> device, std::string const &path, VkFormat format, VkImageTiling tiling) const
+{
+    if (path.ends_with(".ktx2"))
+    {
+        return TextureData::createFromFile(device, path, format, tiling);
+    }
+
+    uint64 const sourceHash = hash(MappedFile::create(path).data());
+    std::filesystem::path const entry = entryPath(sourceHash, format, tiling);
+
+    if (std::filesystem::exists(entry))
+    {
+        auto const file = MappedFile::create(entry);
+        auto const bytes = file.data();
+
+        EntryHeader header {};
+        if (bytes.size() >= sizeof(header))
+        {
+            std::memcpy(&header, bytes.data(), sizeof(header));
+        }
+
+        bool const valid = header.magic == magic && header.sourceHash == sourceHash &&
+                           bytes.size() >= dataOffset(header.regionCount) + header.dataSize;
+
+        // The device may not blit what an entry made by another device expects to be blitted.
+        VkFormatFeatureFlags const blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                                  VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        bool const needsBlit = header.regionCount == 1 && header.mipLevels > 1;
+        bool const canBlit = (device->formatProperties(static_cast<VkFormat>(header.format)).optimalTilingFeatures & blitFeatures) == blitFeatures;
+
+        if (valid && (!needsBlit || canBlit))
+        {
+            spdlog::debug("Loading texture {} from cache {}.", path, entry.string());
+
+            std::vector<VkBufferImageCopy> regions(header.regionCount);
+            std::memcpy(regions.data(), bytes.data() + sizeof(header), regions.size() * sizeof(VkBufferImageCopy));
+
+            auto staging = Buffer::create(device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, header.dataSize, DeviceAllocator::MemoryUsage::Upload);
+            std::memcpy(staging.data().data(), bytes.data() + dataOffset(header.regionCount), header.dataSize);
+            staging.flush();
+
+            return TextureData::create(static_cast<VkFormat>(header.format), static_cast<VkImageTiling>(header.tiling),
+                                       {.width = header.width, .height = header.height}, header.mipLevels, header.usage,
+                                       std::move(staging), std::move(regions));
+        }
+
+        spdlog::warn("Ignoring invalid texture cache entry {}.", entry.string());
+    }
+
+    auto data = TextureData::createFromFile(device, path, format, tiling);
+    store(entry, sourceHash, data);
+
+    return data;
+}
+
+std::filesystem::path TextureCache::entryPath(uint64 sourceHash, VkFormat format, VkImageTiling tiling) const
+{
+    return _directory / fmt::format("{:016x}-{}-{}.texture", sourceHash, static_cast<uint32>(format), static_cast<uint32>(tiling));
+}
+
+void TextureCache::store(std::filesystem::path const &entry, uint64 sourceHash, TextureData const &data)
+{
+    auto const regions = data.regions();
+    auto const bytes = data.bytes();
+
+    EntryHeader const header
+    {
+        .magic = magic,
+        .sourceHash = sourceHash,
+        .format = static_cast<uint32>(data.format()),
+        .tiling = static_cast<uint32>(data.tiling()),
+        .width = data.size().width,
+        .height = data.size().height,
+        .mipLevels = data.mipLevels(),
+        .usage = data.usage(),
+        .regionCount = static_cast<uint32>(regions.size()),
+        .padding = 0,
+        .dataSize = bytes.size(),
+    };
+
+    // Write aside then rename, so a reader never sees a partial entry, even with several writers.
+    std::filesystem::path temporary = entry;
+    temporary += fmt::format(".{}.tmp", std::hash<std::thread::id> {}(std::this_thread::get_id()));
+
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            spdlog::warn("Can not write texture cache entry {}.", entry.string());
+            return;
+        }
+
+        std::array<char, dataAlignment> const zeros {};
+        usize const padding = dataOffset(regions.size()) - sizeof(header) - regions.size_bytes();
+
+        file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+        file.write(reinterpret_cast<char const *>(regions.data()), static_cast<std::streamsize>(regions.size_bytes()));
+        file.write(zeros.data(), static_cast<std::streamsize>(padding));
+        file.write(reinterpret_cast<char const *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, entry, error);
+    if (error)
+    {
+        spdlog::warn("Can not write texture cache entry {}: {}.", entry.string(), error.message());
+        std::filesystem::remove(temporary, error);
+    }
+}
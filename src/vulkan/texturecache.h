@@ -0,0 +1,46 @@
+#ifndef VULKAN_ENGINE_TEXTURECACHE_H
+#define VULKAN_ENGINE_TEXTURECACHE_H
+
+#include <filesystem>
+#include <string>
+
+#include "vulkan.h"
+#include "logicaldevice.h"
+#include "texturedata.h"
+
+namespace Engine::Vulkan
+{
+/**
+ * On-disk cache of decoded textures, so images are decoded only once and not at every launch.
+ *
+ * Entries hold the GPU ready bytes (format, extent, mip levels, copy regions) and are named after a hash of the
+ * content of the source file: editing the source makes the old entry unreachable. Entries are memory mapped and
+ * copied straight into staging memory.
+ *
+ * It is safe to use from several threads at once.
+ */
+class TextureCache
+{
+public:
+    /**
+     * @param directory Where entries are stored, created if needed.
+     */
+    [[nodiscard]] static TextureCache create(std::filesystem::path directory);
+
+    /**
+     * Load `path` from the cache, or decode it and store it in the cache. See `TextureData::createFromFile()`.
+     * KTX2 files are already GPU ready, they bypass the cache.
+     */
+    [[nodiscard]] TextureData load(not_null<LogicalDevice*> device, std::string const &path, VkFormat format, VkImageTiling tiling) const;
+
+private:
+    explicit TextureCache(std::filesystem::path &&directory);
+
+    std::filesystem::path _directory;
+
+    [[nodiscard]] std::filesystem::path entryPath(uint64 sourceHash, VkFormat format, VkImageTiling tiling) const;
+    static void store(std::filesystem::path const &entry, uint64 sourceHash, TextureData const &data);
+};
+}
+
+#endif //VULKAN_ENGINE_TEXTURECACHE_H
@@ -0,0 +1,178 @@
+#include "texturedata.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <stb_image.h>
+
+#include "ktx2texture.h"
+#include "mipchain.h"
+
+using namespace Engine::Vulkan;
+
+namespace
+{
+Buffer createStaging(not_null<LogicalDevice *> device, std::span<std::byte const> data)
+{
+    auto staging = Buffer::create(device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, data.size(), DeviceAllocator::MemoryUsage::Upload);
+    std::memcpy(staging.data().data(), data.data(), data.size());
+    staging.flush();
+
+    return staging;
+}
+}
+
+TextureData TextureData::createFromFile(not_null<LogicalDevice *> device, std::string const &path, VkFormat format,
+                                        VkImageTiling tiling)
+{
+    spdlog::debug("Loading texture {}.", path);
+
+    if (path.ends_with(".ktx2"))
+    {
+        auto const texture = Ktx2Texture::createFromFile(path);
+        auto const regions = texture.regions();
+
+        return TextureData(texture.format(), tiling, texture.size(), texture.levelCount(), VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                           createStaging(device, texture.data()), {regions.begin(), regions.end()});
+    }
+
+    int width {};
+    int height {};
+    int channels;
+
+    stbi_uc *pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels)
+    {
+        throw std::runtime_error("can not open texture " + path);
+    }
+
+    VkExtent2D const size {.width = static_cast<uint32>(width), .height = static_cast<uint32>(height)};
+    auto const texels = std::as_bytes(std::span(pixels, usize {size.width} * size.height * 4));
+
+    // Linear tiling images hardly support more than one level.
+    uint32 const mipLevels = tiling == VK_IMAGE_TILING_OPTIMAL ? MipChain::levelCount(size) : 1;
+
+    VkFormatFeatureFlags const blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                              VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    bool const canBlit = (device->formatProperties(format).optimalTilingFeatures & blitFeatures) == blitFeatures;
+
+    if (mipLevels == 1 || canBlit)
+    {
+        // Lower levels, if any, are blitted from the first one.
+        VkImageUsageFlags const usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | (mipLevels > 1 ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
+        auto staging = createStaging(device, texels);
+        stbi_image_free(pixels);
+
+        VkBufferImageCopy const region
+        {
+            .bufferOffset = 0,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = 0,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+            .imageOffset = {.x = 0, .y = 0, .z = 0},
+            .imageExtent = {.width = size.width, .height = size.height, .depth = 1},
+        };
+
+        return TextureData(format, tiling, size, mipLevels, usage, std::move(staging), {region});
+    }
+
+    bool const srgb = format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_SRGB;
+    auto const chain = MipChain::generate(texels, size, srgb);
+    stbi_image_free(pixels);
+
+    auto const regions = chain.regions();
+
+    return TextureData(format, tiling, size, mipLevels, VK_IMAGE_USAGE_TRANSFER_DST_BIT, createStaging(device, chain.data()),
+                       {regions.begin(), regions.end()});
+}
+
+TextureData TextureData::create(VkFormat format, VkImageTiling tiling, VkExtent2D size, uint32 mipLevels, VkImageUsageFlags usage,
+                                Buffer &&staging, std::vector<VkBufferImageCopy> &&regions)
+{
+    return TextureData(format, tiling, size, mipLevels, usage, std::move(staging), std::move(regions));
+}
+
+std::string const &TextureData::findSupportedFile(not_null<LogicalDevice *> device, std::span<std::string const> paths,
+                                                  VkImageTiling tiling)
+{
+    for (auto const &path : paths)
+    {
+        if (!path.ends_with(".ktx2"))
+        {
+            return path;
+        }
+
+        auto const fileFormat = Ktx2Texture::readFormat(path);
+        if (!fileFormat.has_value())
+        {
+            continue;
+        }
+
+        VkFormatProperties const properties = device->formatProperties(*fileFormat);
+        VkFormatFeatureFlags const features = tiling == VK_IMAGE_TILING_OPTIMAL ? properties.optimalTilingFeatures : properties.linearTilingFeatures;
+        if (features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)
+        {
+            return path;
+        }
+
+        spdlog::debug("Skipping texture {}, its format {} can't be sampled.", path, static_cast<uint32>(*fileFormat));
+    }
+
+    throw std::runtime_error("None of the texture files can be loaded.");
+}
+
+TextureData::TextureData(VkFormat format, VkImageTiling tiling, VkExtent2D size, uint32 mipLevels, VkImageUsageFlags usage,
+                         Buffer &&staging, std::vector<VkBufferImageCopy> &&regions) :
+_format(format),
+_tiling(tiling),
+_size(size),
+_mipLevels(mipLevels),
+_usage(usage),
+_staging(std::move(staging)),
+_regions(std::move(regions))
+{}
+
+VkFormat TextureData::format() const
+{
+    return _format;
+}
+
+VkImageTiling TextureData::tiling() const
+{
+    return _tiling;
+}
+
+VkExtent2D TextureData::size() const
+{
+    return _size;
+}
+
+uint32 TextureData::mipLevels() const
+{
+    return _mipLevels;
+}
+
+VkImageUsageFlags TextureData::usage() const
+{
+    return _usage;
+}
+
+std::span<VkBufferImageCopy const> TextureData::regions() const
+{
+    return _regions;
+}
+
+std::span<std::byte const> TextureData::bytes() const
+{
+    return _staging.data();
+}
+
+Buffer TextureData::takeStaging()
+{
+    return std::move(_staging);
+}
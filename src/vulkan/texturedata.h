@@ -0,0 +1,73 @@
+#ifndef VULKAN_ENGINE_TEXTUREDATA_H
+#define VULKAN_ENGINE_TEXTUREDATA_H
+
+#include <span>
+#include <string>
+#include <vector>
+
+#include "vulkan.h"
+#include "logicaldevice.h"
+#include "buffer.h"
+
+namespace Engine::Vulkan
+{
+/**
+ * A texture read and decoded from a file, into staging memory, ready to be copied into an `Image`.
+ *
+ * Creating one only touches the thread safe parts of the device, so it can be done on worker threads.
+ */
+class TextureData : public OnlyMovable
+{
+public:
+    /**
+     * KTX2 files are kept in their own format, with their own mip levels, and `format` is ignored. Other files are
+     * decoded to RGBA8 by stb_image. Optimal tiling images get a full mip chain: either blitted by the device
+     * from the first level when the format supports it, or generated here.
+     */
+    [[nodiscard]] static TextureData createFromFile(not_null<LogicalDevice*> device, std::string const &path,
+                                                    VkFormat format, VkImageTiling tiling);
+    /**
+     * From texels already in `staging`, for instance read back from a `TextureCache`.
+     */
+    [[nodiscard]] static TextureData create(VkFormat format, VkImageTiling tiling, VkExtent2D size, uint32 mipLevels,
+                                            VkImageUsageFlags usage, Buffer &&staging, std::vector<VkBufferImageCopy> &&regions);
+    /**
+     * The first of `paths` the device can sample. Missing KTX2 files and KTX2 files in an unsupported format are
+     * skipped, other files are always supported.
+     */
+    [[nodiscard]] static std::string const &findSupportedFile(not_null<LogicalDevice*> device, std::span<std::string const> paths,
+                                                              VkImageTiling tiling);
+
+    TextureData(TextureData &&) noexcept = default;
+    TextureData &operator=(TextureData &&) noexcept = default;
+
+    [[nodiscard]] VkFormat format() const;
+    [[nodiscard]] VkImageTiling tiling() const;
+    [[nodiscard]] VkExtent2D size() const;
+    [[nodiscard]] uint32 mipLevels() const;
+    /**
+     * Usage the image needs to be filled from this data.
+     */
+    [[nodiscard]] VkImageUsageFlags usage() const;
+    [[nodiscard]] std::span<VkBufferImageCopy const> regions() const;
+    /**
+     * Content of the staging buffer, the regions point into it.
+     */
+    [[nodiscard]] std::span<std::byte const> bytes() const;
+    [[nodiscard]] Buffer takeStaging();
+
+private:
+    TextureData(VkFormat format, VkImageTiling tiling, VkExtent2D size, uint32 mipLevels, VkImageUsageFlags usage,
+                Buffer &&staging, std::vector<VkBufferImageCopy> &&regions);
+
+    VkFormat _format;
+    VkImageTiling _tiling;
+    VkExtent2D _size;
+    uint32 _mipLevels;
+    VkImageUsageFlags _usage;
+    Buffer _staging;
+    std::vector<VkBufferImageCopy> _regions;
+};
+}
+
+#endif //VULKAN_ENGINE_TEXTUREDATA_H
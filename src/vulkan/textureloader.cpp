@@ -0,0 +1,112 @@
+#include "textureloader.h"
+
+using namespace Engine::Vulkan;
+
+TextureLoader TextureLoader::create(not_null<LogicalDevice *> device, not_null<UploadService *> uploads,
+                                    std::optional<TextureCache> cache, usize threadCount)
+{
+    return TextureLoader(device, uploads, std::move(cache), ThreadPool::create(threadCount));
+}
+
+TextureLoader::TextureLoader(not_null<LogicalDevice *> device, not_null<UploadService *> uploads,
+                             std::optional<TextureCache> &&cache, ThreadPool &&threads) :
+_device(device),
+_uploads(uploads),
+_cache(std::move(cache)),
+_threads(std::move(threads))
+{}
+
+TextureLoader::Handle TextureLoader::load(std::string path, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage)
+{
+    LogicalDevice *device = _device;
+    auto data = _threads.submit([device, cache = _cache, path = std::move(path), format, tiling]()
+    {
+        return cache.has_value() ? cache->load(device, path, format, tiling) : TextureData::createFromFile(device, path, format, tiling);
+    });
+
+    _textures.push_back({.data = std::move(data), .usage = usage});
+
+    return _textures.size() - 1;
+}
+
+void TextureLoader::update()
+{
+    bool recorded = false;
+    std::exception_ptr error;
+
+    for (auto &texture : _textures)
+    {
+        // The future is consumed once recorded, successfully or not.
+        if (texture.data.valid() && texture.data.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            try
+            {
+                record(texture);
+                recorded = true;
+            }
+            catch (...)
+            {
+                // Textures decoded by now still get uploaded.
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+            }
+        }
+    }
+
+    if (recorded)
+    {
+        // Every batch up to the last one holds an image recorded here.
+        UploadService::Token const token = _uploads->submit();
+        for (auto &texture : _textures)
+        {
+            if (texture.image.has_value() && texture.token == 0)
+            {
+                texture.token = token;
+            }
+        }
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+Image &TextureLoader::wait(Handle handle)
+{
+    Texture &texture = _textures.at(handle);
+    if (texture.error)
+    {
+        std::rethrow_exception(texture.error);
+    }
+
+    if (!texture.image.has_value())
+    {
+        record(texture);
+        texture.token = _uploads->submit();
+    }
+
+    return *texture.image;
+}
+
+bool TextureLoader::isReady(Handle handle) const
+{
+    Texture const &texture = _textures.at(handle);
+
+    return texture.image.has_value() && _uploads->isComplete(texture.token);
+}
+
+void TextureLoader::record(Texture &texture)
+{
+    try
+    {
+        texture.image.emplace(Image::createFromData(texture.data.get(), _device, *_uploads, texture.usage));
+    }
+    catch (...)
+    {
+        texture.error = std::current_exception();
+        throw;
+    }
+}
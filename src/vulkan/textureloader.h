@@ -0,0 +1,92 @@
+#ifndef VULKAN_ENGINE_TEXTURELOADER_H
+#define VULKAN_ENGINE_TEXTURELOADER_H
+
+#include <deque>
+#include <exception>
+#include <future>
+#include <optional>
+#include <string>
+
+#include "vulkan.h"
+#include "logicaldevice.h"
+#include "image.h"
+#include "texturecache.h"
+#include "texturedata.h"
+#include "uploadservice.h"
+#include "../misc/threadpool.h"
+
+namespace Engine::Vulkan
+{
+/**
+ * Load textures in the background: worker threads read and decode files into staging memory, the thread owning
+ * the loader only records the copies, through an `UploadService`.
+ *
+ * Every method must be called from the thread owning the loader and its upload service.
+ */
+class TextureLoader : public OnlyMovable
+{
+public:
+    /**
+     * Identify a texture given to `load()`.
+     */
+    using Handle = usize;
+
+    /**
+     * @param cache Where to find decoded textures, and store newly decoded ones. Every texture is decoded if none.
+     * @param threadCount Number of decoding threads, one per hardware thread if 0.
+     */
+    [[nodiscard]] static TextureLoader create(not_null<LogicalDevice*> device, not_null<UploadService*> uploads,
+                                              std::optional<TextureCache> cache = std::nullopt, usize threadCount = 0);
+
+    TextureLoader(TextureLoader &&) noexcept = default;
+    TextureLoader &operator=(TextureLoader &&) = delete;
+
+    /**
+     * Queue a texture for decoding, see `TextureData::createFromFile()` and `TextureCache::load()`.
+     */
+    [[nodiscard]] Handle load(std::string path, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage);
+    /**
+     * Create the images of the textures decoded since the previous call, and record their uploads. Call it once per
+     * frame. Decoding errors are thrown from here, once per texture: the other textures are still recorded.
+     */
+    void update();
+    /**
+     * Block until the texture is decoded, and record its upload if it isn't yet.
+     *
+     * @return The image, usable by the device once `isReady()`.
+     * @throws The decoding error of the texture, every time if it failed.
+     */
+    Image &wait(Handle handle);
+    /**
+     * Whether the texture has been uploaded, and can be used by commands recorded after the last
+     * `UploadService::cmdAcquire()`.
+     */
+    [[nodiscard]] bool isReady(Handle handle) const;
+
+private:
+    struct Texture
+    {
+        std::future<TextureData> data;
+        VkImageUsageFlags usage;
+        std::optional<Image> image;
+        UploadService::Token token = 0;
+        // Set when decoding or recording failed, the data is then consumed and the image never created.
+        std::exception_ptr error;
+    };
+
+    TextureLoader(not_null<LogicalDevice*> device, not_null<UploadService*> uploads, std::optional<TextureCache> &&cache,
+                  ThreadPool &&threads);
+
+    not_null<LogicalDevice*> _device;
+    not_null<UploadService*> _uploads;
+    std::optional<TextureCache> _cache;
+    // Never shrinks, so references to images stay valid.
+    std::deque<Texture> _textures;
+    // Last, to stop workers before anything they may use is destroyed.
+    ThreadPool _threads;
+
+    void record(Texture &texture);
+};
+}
+
+#endif //VULKAN_ENGINE_TEXTURELOADER_H
@@ -0,0 +1,279 @@
+#include "tlsf.h"
+
+#include <algorithm>
+#include <bit>
+
+using namespace Engine::Vulkan;
+
+Tlsf Tlsf::create(VkDeviceSize size)
+{
+    return Tlsf(size);
+}
+
+Tlsf::Tlsf(VkDeviceSize size) :
+_size(size),
+_freeSize(size)
+{
+    // At the beginning, the whole block is one big free range.
+    Node *node = createNode();
+    node->offset = 0;
+    node->size = size;
+    insertFree(node);
+}
+
+Tlsf::Node *Tlsf::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+    if (size == 0 || size > _freeSize)
+    {
+        return nullptr;
+    }
+
+    // Look for a range large enough to hold `size` whatever the alignment padding is.
+    VkDeviceSize const searchSize = size + alignment - 1;
+    Node *node = findSuitable(mappingSearch(searchSize));
+    if (!node)
+    {
+        // Rounding up the search may skip a range that would have fit: check the exact list too.
+        auto const [firstLevel, secondLevel] = mappingInsert(searchSize);
+        node = firstLevel < firstLevelCount ? _freeLists[firstLevel][secondLevel] : nullptr;
+        if (!node || node->size < searchSize)
+        {
+            return nullptr;
+        }
+    }
+    removeFree(node);
+
+    // Give the padding in front of the aligned offset back as a free range.
+    // The previous physical node can't be free, it would have been coalesced with `node`.
+    VkDeviceSize const padding = (alignment - node->offset % alignment) % alignment;
+    if (padding > 0)
+    {
+        Node *front = createNode();
+        front->offset = node->offset;
+        front->size = padding;
+        front->previousPhysical = node->previousPhysical;
+        front->nextPhysical = node;
+        if (front->previousPhysical)
+        {
+            front->previousPhysical->nextPhysical = front;
+        }
+
+        node->previousPhysical = front;
+        node->offset += padding;
+        node->size -= padding;
+        insertFree(front);
+    }
+
+    // Give the remaining tail back as a free range.
+    if (node->size > size)
+    {
+        Node *back = createNode();
+        back->offset = node->offset + size;
+        back->size = node->size - size;
+        back->previousPhysical = node;
+        back->nextPhysical = node->nextPhysical;
+        if (back->nextPhysical)
+        {
+            back->nextPhysical->previousPhysical = back;
+        }
+
+        node->nextPhysical = back;
+        node->size = size;
+        insertFree(back);
+    }
+
+    node->isFree = false;
+    _freeSize -= size;
+
+    return node;
+}
+
+void Tlsf::free(Node *node)
+{
+    _freeSize += node->size;
+    node->isFree = true;
+
+    // Coalesce with free physical neighbours.
+    if (Node *previous = node->previousPhysical; previous && previous->isFree)
+    {
+        removeFree(previous);
+        previous->size += node->size;
+        previous->nextPhysical = node->nextPhysical;
+        if (previous->nextPhysical)
+        {
+            previous->nextPhysical->previousPhysical = previous;
+        }
+
+        destroyNode(node);
+        node = previous;
+    }
+
+    if (Node *next = node->nextPhysical; next && next->isFree)
+    {
+        removeFree(next);
+        node->size += next->size;
+        node->nextPhysical = next->nextPhysical;
+        if (node->nextPhysical)
+        {
+            node->nextPhysical->previousPhysical = node;
+        }
+
+        destroyNode(next);
+    }
+
+    insertFree(node);
+}
+
+VkDeviceSize Tlsf::size() const
+{
+    return _size;
+}
+
+VkDeviceSize Tlsf::freeSize() const
+{
+    return _freeSize;
+}
+
+VkDeviceSize Tlsf::largestFreeSize() const
+{
+    if (!_firstLevelBitmap)
+    {
+        return 0;
+    }
+
+    // The largest range lives in the highest non-empty list, but that list isn't sorted.
+    auto const firstLevel = static_cast<uint32>(63 - std::countl_zero(_firstLevelBitmap));
+    auto const secondLevel = static_cast<uint32>(31 - std::countl_zero(_secondLevelBitmaps[firstLevel]));
+
+    VkDeviceSize largest = 0;
+    for (Node const *node = _freeLists[firstLevel][secondLevel]; node; node = node->nextFree)
+    {
+        largest = std::max(largest, node->size);
+    }
+
+    return largest;
+}
+
+bool Tlsf::empty() const
+{
+    return _freeSize == _size;
+}
+
+Tlsf::Mapping Tlsf::mappingInsert(VkDeviceSize size)
+{
+    // Small sizes all go to the first level, with a granularity of one byte.
+    if (size < secondLevelCount)
+    {
+        return {0, static_cast<uint32>(size)};
+    }
+
+    auto const mostSignificantBit = static_cast<uint32>(std::bit_width(size) - 1);
+    auto const secondLevel = static_cast<uint32>(size >> (mostSignificantBit - secondLevelCountLog2)) ^ secondLevelCount;
+
+    return {mostSignificantBit - secondLevelCountLog2 + 1, secondLevel};
+}
+
+Tlsf::Mapping Tlsf::mappingSearch(VkDeviceSize size)
+{
+    // Round up to the next second level range, so any range found in the resulting list is large enough.
+    if (size >= secondLevelCount)
+    {
+        auto const mostSignificantBit = static_cast<uint32>(std::bit_width(size) - 1);
+        size += (VkDeviceSize {1} << (mostSignificantBit - secondLevelCountLog2)) - 1;
+    }
+
+    return mappingInsert(size);
+}
+
+Tlsf::Node *Tlsf::findSuitable(Mapping mapping)
+{
+    if (mapping.firstLevel >= firstLevelCount)
+    {
+        return nullptr;
+    }
+
+    uint32 secondLevelMap = _secondLevelBitmaps[mapping.firstLevel] & (~0u << mapping.secondLevel);
+    if (!secondLevelMap)
+    {
+        // Nothing in this first level, look at the next non-empty larger one.
+        uint64 const firstLevelMap = mapping.firstLevel + 1 < 64 ? _firstLevelBitmap & (~uint64 {0} << (mapping.firstLevel + 1)) : 0;
+        if (!firstLevelMap)
+        {
+            return nullptr;
+        }
+
+        mapping.firstLevel = static_cast<uint32>(std::countr_zero(firstLevelMap));
+        secondLevelMap = _secondLevelBitmaps[mapping.firstLevel];
+    }
+
+    mapping.secondLevel = static_cast<uint32>(std::countr_zero(secondLevelMap));
+
+    return _freeLists[mapping.firstLevel][mapping.secondLevel];
+}
+
+void Tlsf::insertFree(Node *node)
+{
+    auto const [firstLevel, secondLevel] = mappingInsert(node->size);
+    Node *&head = _freeLists[firstLevel][secondLevel];
+
+    node->isFree = true;
+    node->previousFree = nullptr;
+    node->nextFree = head;
+    if (head)
+    {
+        head->previousFree = node;
+    }
+    head = node;
+
+    _firstLevelBitmap |= uint64 {1} << firstLevel;
+    _secondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+}
+
+void Tlsf::removeFree(Node *node)
+{
+    auto const [firstLevel, secondLevel] = mappingInsert(node->size);
+
+    if (node->previousFree)
+    {
+        node->previousFree->nextFree = node->nextFree;
+    }
+    else
+    {
+        _freeLists[firstLevel][secondLevel] = node->nextFree;
+    }
+
+    if (node->nextFree)
+    {
+        node->nextFree->previousFree = node->previousFree;
+    }
+
+    node->previousFree = nullptr;
+    node->nextFree = nullptr;
+
+    if (!_freeLists[firstLevel][secondLevel])
+    {
+        _secondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+        if (!_secondLevelBitmaps[firstLevel])
+        {
+            _firstLevelBitmap &= ~(uint64 {1} << firstLevel);
+        }
+    }
+}
+
+Tlsf::Node *Tlsf::createNode()
+{
+    if (!_unusedNodes.empty())
+    {
+        Node *node = _unusedNodes.back();
+        _unusedNodes.pop_back();
+        *node = Node {};
+        return node;
+    }
+
+    return &_nodes.emplace_back();
+}
+
+void Tlsf::destroyNode(Node *node)
+{
+    _unusedNodes.push_back(node);
+}
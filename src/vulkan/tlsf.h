@@ -0,0 +1,103 @@
+#ifndef VULKAN_ENGINE_TLSF_H
+#define VULKAN_ENGINE_TLSF_H
+
+#include <array>
+#include <deque>
+#include <vector>
+
+#include "vulkan.h"
+
+namespace Engine::Vulkan
+{
+/**
+ * Two-Level Segregated Fit block manager.
+ *
+ * It manages the range [0, size) of a single device memory block and hands out sub-ranges of it. It doesn't own
+ * or touch any device memory: it only does the bookkeeping.
+ *
+ * Free ranges are kept in segregated lists indexed by a first level (power of two) and a second level (linear
+ * subdivision of that power of two). Two bitmaps allow to find a suitable free range with a couple of bit scans,
+ * so both `allocate()` and `free()` run in constant time. Adjacent free ranges are coalesced immediately.
+ */
+class Tlsf : public OnlyMovable
+{
+public:
+    /**
+     * A range of the managed block. Physical neighbours are linked together, free ranges are also linked inside
+     * their segregated list.
+     *
+     * Nodes returned by `allocate()` stay valid until they are given back to `free()`.
+     */
+    struct Node
+    {
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        bool isFree = true;
+
+        Node *previousPhysical = nullptr;
+        Node *nextPhysical = nullptr;
+        Node *previousFree = nullptr;
+        Node *nextFree = nullptr;
+    };
+
+    [[nodiscard]] static Tlsf create(VkDeviceSize size);
+
+    ~Tlsf() = default;
+    Tlsf(Tlsf &&) noexcept = default;
+    Tlsf &operator=(Tlsf &&) noexcept = default;
+
+    /**
+     * Reserve a range of `size` bytes whose offset is a multiple of `alignment`.
+     *
+     * @return The reserved range, or `nullptr` if no free range is large enough.
+     */
+    [[nodiscard]] Node *allocate(VkDeviceSize size, VkDeviceSize alignment = 1);
+    void free(Node *node);
+
+    [[nodiscard]] VkDeviceSize size() const;
+    [[nodiscard]] VkDeviceSize freeSize() const;
+    /**
+     * Size of the largest free range, the biggest request `allocate()` could satisfy without alignment.
+     */
+    [[nodiscard]] VkDeviceSize largestFreeSize() const;
+    [[nodiscard]] bool empty() const;
+
+private:
+    // Each power of two is split into 2^secondLevelCountLog2 linear ranges.
+    static constexpr uint32 secondLevelCountLog2 = 5;
+    static constexpr uint32 secondLevelCount = 1u << secondLevelCountLog2;
+    // Enough first levels to index any 64 bits size.
+    static constexpr uint32 firstLevelCount = 64 - secondLevelCountLog2 + 1;
+
+    struct Mapping
+    {
+        uint32 firstLevel;
+        uint32 secondLevel;
+    };
+
+    explicit Tlsf(VkDeviceSize size);
+
+    VkDeviceSize _size;
+    VkDeviceSize _freeSize;
+
+    uint64 _firstLevelBitmap = 0;
+    std::array<uint32, firstLevelCount> _secondLevelBitmaps {};
+    std::array<std::array<Node *, secondLevelCount>, firstLevelCount> _freeLists {};
+
+    // Nodes storage. `std::deque` never moves its elements, so `Node *` stay valid.
+    std::deque<Node> _nodes;
+    std::vector<Node *> _unusedNodes;
+
+    static Mapping mappingInsert(VkDeviceSize size);
+    static Mapping mappingSearch(VkDeviceSize size);
+
+    Node *findSuitable(Mapping mapping);
+    void insertFree(Node *node);
+    void removeFree(Node *node);
+
+    Node *createNode();
+    void destroyNode(Node *node);
+};
+}
+
+#endif //VULKAN_ENGINE_TLSF_H
@@ -6,7 +6,7 @@ UniformBuffer UniformBuffer::create(not_null<LogicalDevice*> device)
 {
     VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
-    auto buffer = Buffer::create(device, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, bufferSize, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    auto buffer = Buffer::create(device, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, bufferSize, DeviceAllocator::MemoryUsage::Streaming);
 
     return UniformBuffer(std::move(buffer));
 }
@@ -0,0 +1,507 @@
+#include "uploadservice.h"
+#include "mipchain.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <numeric>
+
+using namespace Engine::Vulkan;
+
+namespace
+{
+/**
+ * Size in bytes of a texel, or of a compressed block, of `format`. For the formats of extensions not listed, a
+ * multiple of it.
+ */
+VkDeviceSize texelBlockSize(VkFormat format)
+{
+    // Core formats are numbered by groups of the same size.
+    struct FormatGroup
+    {
+        VkFormat last;
+        VkDeviceSize size;
+    };
+
+    constexpr std::array<FormatGroup, 36> groups
+    {{
+        {VK_FORMAT_R4G4_UNORM_PACK8, 1},
+        {VK_FORMAT_A1R5G5B5_UNORM_PACK16, 2},
+        {VK_FORMAT_R8_SRGB, 1},
+        {VK_FORMAT_R8G8_SRGB, 2},
+        {VK_FORMAT_B8G8R8_SRGB, 3},
+        {VK_FORMAT_A2B10G10R10_SINT_PACK32, 4},
+        {VK_FORMAT_R16_SFLOAT, 2},
+        {VK_FORMAT_R16G16_SFLOAT, 4},
+        {VK_FORMAT_R16G16B16_SFLOAT, 6},
+        {VK_FORMAT_R16G16B16A16_SFLOAT, 8},
+        {VK_FORMAT_R32_SFLOAT, 4},
+        {VK_FORMAT_R32G32_SFLOAT, 8},
+        {VK_FORMAT_R32G32B32_SFLOAT, 12},
+        {VK_FORMAT_R32G32B32A32_SFLOAT, 16},
+        {VK_FORMAT_R64_SFLOAT, 8},
+        {VK_FORMAT_R64G64_SFLOAT, 16},
+        {VK_FORMAT_R64G64B64_SFLOAT, 24},
+        {VK_FORMAT_R64G64B64A64_SFLOAT, 32},
+        {VK_FORMAT_E5B9G9R9_UFLOAT_PACK32, 4},
+        {VK_FORMAT_D16_UNORM, 2},
+        {VK_FORMAT_D32_SFLOAT, 4},
+        {VK_FORMAT_S8_UINT, 1},
+        {VK_FORMAT_D16_UNORM_S8_UINT, 3},
+        {VK_FORMAT_D24_UNORM_S8_UINT, 4},
+        {VK_FORMAT_D32_SFLOAT_S8_UINT, 5},
+        {VK_FORMAT_BC1_RGBA_SRGB_BLOCK, 8},
+        {VK_FORMAT_BC3_SRGB_BLOCK, 16},
+        {VK_FORMAT_BC4_SNORM_BLOCK, 8},
+        {VK_FORMAT_BC7_SRGB_BLOCK, 16},
+        {VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK, 8},
+        {VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK, 16},
+        {VK_FORMAT_EAC_R11_SNORM_BLOCK, 8},
+        {VK_FORMAT_EAC_R11G11_SNORM_BLOCK, 16},
+        {VK_FORMAT_ASTC_12x12_SRGB_BLOCK, 16},
+        {VK_FORMAT_PVRTC2_4BPP_SRGB_BLOCK_IMG, 8},
+        {VK_FORMAT_ASTC_12x12_SFLOAT_BLOCK, 16},
+    }};
+
+    for (auto const &group : groups)
+    {
+        if (format <= group.last)
+        {
+            return group.size;
+        }
+    }
+
+    // A multiple of every size above.
+    return 480;
+}
+}
+
+UploadService UploadService::create(not_null<LogicalDevice *> device)
+{
+    auto commandPool = std::make_unique<CommandPool>(CommandPool::create(device, device->queueFamilies().transfer.value()));
+    auto ring = Buffer::create(device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, ringSize, DeviceAllocator::MemoryUsage::Upload);
+
+    // Copies to images also need offsets multiple of the texel size, see `stage()`.
+    VkDeviceSize const alignment = std::max<VkDeviceSize>(4, device->properties().limits.optimalBufferCopyOffsetAlignment);
+
+    return UploadService(device, std::move(commandPool), std::move(ring), alignment);
+}
+
+UploadService::UploadService(not_null<LogicalDevice *> device, std::unique_ptr<CommandPool> commandPool, Buffer &&ring,
+                             VkDeviceSize ringAlignment) :
+_device(device),
+_commandPool(std::move(commandPool)),
+_transferFamily(device->queueFamilies().transfer.value()),
+_graphicsFamily(device->queueFamilies().graphics.value()),
+_ring(std::move(ring)),
+_ringAlignment(ringAlignment)
+{}
+
+UploadService::~UploadService()
+{
+    // The command buffers and staging buffers of in flight batches can't be freed before the device is done.
+    for (auto &batch : _pending)
+    {
+        vkWaitForFences(*_device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        vkDestroyFence(*_device, batch.fence, nullptr);
+    }
+}
+
+void UploadService::uploadToBuffer(Buffer &destination, std::span<std::byte const> data, VkDeviceSize offset)
+{
+    Staging const staging = stage(data, _ringAlignment);
+    Batch &batch = recording();
+
+    VkBufferCopy const region
+    {
+        .srcOffset = staging.offset,
+        .dstOffset = offset,
+        .size = data.size(),
+    };
+    vkCmdCopyBuffer(batch.commandBuffer, staging.buffer, destination, 1, &region);
+
+    VkBufferMemoryBarrier barrier
+    {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = 0,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = destination,
+        .offset = offset,
+        .size = data.size(),
+    };
+
+    if (transfersOwnership())
+    {
+        barrier.srcQueueFamilyIndex = _transferFamily;
+        barrier.dstQueueFamilyIndex = _graphicsFamily;
+        vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                             0, nullptr, 1, &barrier, 0, nullptr);
+
+        // The release made the copy available.
+        barrier.srcAccessMask = 0;
+    }
+
+    // Barriers don't order commands of other queues, even of the same family: the copy is made visible by the
+    // graphics queue.
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    batch.bufferAcquires.push_back(barrier);
+
+    batch.size += data.size();
+    if (batch.size >= flushSize)
+    {
+        submit();
+    }
+}
+
+void UploadService::uploadToImage(Image &destination, std::span<std::byte const> pixels, VkExtent2D size)
+{
+    VkBufferImageCopy const region
+    {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource =
+        {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+        .imageOffset = {.x = 0, .y = 0, .z = 0},
+        .imageExtent = {.width = size.width, .height = size.height, .depth = 1},
+    };
+
+    uploadToImage(destination, pixels, {&region, 1});
+}
+
+void UploadService::uploadToImage(Image &destination, std::span<std::byte const> data, std::span<VkBufferImageCopy const> regions)
+{
+    // Copies to images need offsets multiple of both the texel size and 4.
+    VkDeviceSize const alignment = std::lcm(std::lcm(texelBlockSize(destination.format()), VkDeviceSize {4}), _ringAlignment);
+    recordImageUpload(destination, stage(data, alignment), regions, data.size());
+}
+
+void UploadService::uploadToImage(Image &destination, Buffer &&staging, std::span<VkBufferImageCopy const> regions)
+{
+    Staging const staged {.buffer = staging, .offset = 0};
+    VkDeviceSize const size = staging.data().size();
+
+    // Owned by the batch the copy is recorded in.
+    recording().stagingBuffers.push_back(std::move(staging));
+    recordImageUpload(destination, staged, regions, size);
+}
+
+UploadService::Token UploadService::submit()
+{
+    if (!_recording.has_value())
+    {
+        return _lastSubmitted;
+    }
+
+    Batch batch = std::move(*_recording);
+    _recording.reset();
+
+    batch.commandBuffer.end();
+    batch.ringEnd = _ringHead;
+
+    VkFenceCreateInfo const fenceInfo
+    {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+    ThrowError(vkCreateFence(*_device, &fenceInfo, nullptr, &batch.fence));
+
+    batch.commandBuffer.submit(_device->queues().transfer, batch.fence);
+    batch.token = ++_lastSubmitted;
+
+    _pending.push_back(std::move(batch));
+
+    return _lastSubmitted;
+}
+
+void UploadService::cmdAcquire(CommandBuffer &commandBuffer)
+{
+    submitIfDue();
+    reclaimStaging(false);
+
+    while (!_pending.empty() && vkGetFenceStatus(*_device, _pending.front().fence) == VK_SUCCESS)
+    {
+        Batch &batch = _pending.front();
+
+        // The fence made the copies available, the barriers make them visible to the graphics queue.
+        if (!batch.bufferAcquires.empty() || !batch.imageAcquires.empty())
+        {
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                                 0, nullptr,
+                                 static_cast<uint32>(batch.bufferAcquires.size()), batch.bufferAcquires.data(),
+                                 static_cast<uint32>(batch.imageAcquires.size()), batch.imageAcquires.data());
+        }
+
+        for (auto const &mipChain : batch.mipChains)
+        {
+            cmdBlitMipChain(commandBuffer, mipChain);
+        }
+
+        // Every image ends ready to be sampled, with or without a chain to generate.
+        for (auto const &layout : batch.imageLayouts)
+        {
+            *layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        }
+
+        vkDestroyFence(*_device, batch.fence, nullptr);
+        _ringTail = std::max(_ringTail, batch.ringEnd);
+        _lastCompleted = batch.token;
+        _pending.pop_front();
+    }
+}
+
+bool UploadService::isComplete(Token token) const
+{
+    return token <= _lastCompleted;
+}
+
+void UploadService::recordImageUpload(Image &destination, Staging staging, std::span<VkBufferImageCopy const> regions,
+                                      VkDeviceSize size)
+{
+    Batch &batch = recording();
+    bool const generateMipChain = regions.size() == 1 && destination.mipLevels() > 1;
+
+    destination.cmdTransition(batch.commandBuffer, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    std::vector<VkBufferImageCopy> stagedRegions(regions.begin(), regions.end());
+    for (auto &region : stagedRegions)
+    {
+        region.bufferOffset += staging.offset;
+    }
+    vkCmdCopyBufferToImage(batch.commandBuffer, staging.buffer, destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32>(stagedRegions.size()), stagedRegions.data());
+
+    PendingMipChain const mipChain {.image = destination, .size = destination.size(), .levels = destination.mipLevels()};
+
+    // Blits need a graphics queue: a chain to generate stays in transfer layout until the acquire.
+    VkImageMemoryBarrier barrier
+    {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = 0,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = generateMipChain ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = destination,
+        .subresourceRange =
+        {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = VK_REMAINING_MIP_LEVELS,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+
+    if (transfersOwnership())
+    {
+        // The release and the acquire both carry the layout transition, which happens once between them.
+        barrier.srcQueueFamilyIndex = _transferFamily;
+        barrier.dstQueueFamilyIndex = _graphicsFamily;
+        vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+
+        // The release made the copy available.
+        barrier.srcAccessMask = 0;
+    }
+
+    // Same as buffers, the graphics queue transitions the image and makes the copy visible to its own commands.
+    barrier.dstAccessMask = generateMipChain ? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+    batch.imageAcquires.push_back(barrier);
+    batch.imageLayouts.push_back(destination._layout);
+
+    if (generateMipChain)
+    {
+        batch.mipChains.push_back(mipChain);
+    }
+
+    batch.size += size;
+    if (batch.size >= flushSize)
+    {
+        submit();
+    }
+}
+
+void UploadService::cmdBlitMipChain(VkCommandBuffer commandBuffer, PendingMipChain const &mipChain)
+{
+    VkImageMemoryBarrier barrier
+    {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = mipChain.image,
+        .subresourceRange =
+        {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+
+    // Every level is in transfer destination layout, and only the first one is written.
+    for (uint32 level = 1; level < mipChain.levels; ++level)
+    {
+        // The previous level is complete, read from it.
+        barrier.subresourceRange.baseMipLevel = level - 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+
+        VkExtent2D const source = MipChain::levelSize(mipChain.size, level - 1);
+        VkExtent2D const destination = MipChain::levelSize(mipChain.size, level);
+
+        VkImageBlit const blit
+        {
+            .srcSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = level - 1, .baseArrayLayer = 0, .layerCount = 1},
+            .srcOffsets = {{0, 0, 0}, {static_cast<int32_t>(source.width), static_cast<int32_t>(source.height), 1}},
+            .dstSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = level, .baseArrayLayer = 0, .layerCount = 1},
+            .dstOffsets = {{0, 0, 0}, {static_cast<int32_t>(destination.width), static_cast<int32_t>(destination.height), 1}},
+        };
+        vkCmdBlitImage(commandBuffer, mipChain.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       mipChain.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+    }
+
+    // Every level but the last one has been read from.
+    std::array<VkImageMemoryBarrier, 2> toShaderRead {barrier, barrier};
+
+    toShaderRead[0].subresourceRange.baseMipLevel = 0;
+    toShaderRead[0].subresourceRange.levelCount = mipChain.levels - 1;
+    toShaderRead[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    toShaderRead[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    toShaderRead[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    toShaderRead[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    toShaderRead[1].subresourceRange.baseMipLevel = mipChain.levels - 1;
+    toShaderRead[1].subresourceRange.levelCount = 1;
+    toShaderRead[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    toShaderRead[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    toShaderRead[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toShaderRead[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                         0, nullptr, 0, nullptr, static_cast<uint32>(toShaderRead.size()), toShaderRead.data());
+}
+
+UploadService::Batch &UploadService::recording()
+{
+    if (!_recording.has_value())
+    {
+        _recording.emplace(Batch
+        {
+            .commandBuffer = CommandBuffer::create(_device, _commandPool.get()),
+            .started = std::chrono::steady_clock::now(),
+        });
+        _recording->commandBuffer.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    }
+
+    return *_recording;
+}
+
+UploadService::Staging UploadService::stage(std::span<std::byte const> data, VkDeviceSize alignment)
+{
+    if (data.size() > ringSize)
+    {
+        auto buffer = Buffer::create(_device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, data.size(), DeviceAllocator::MemoryUsage::Upload);
+        std::memcpy(buffer.data().data(), data.data(), data.size());
+        buffer.flush();
+
+        Staging const staging {.buffer = buffer, .offset = 0};
+        recording().stagingBuffers.push_back(std::move(buffer));
+
+        return staging;
+    }
+
+    std::optional<VkDeviceSize> offset = allocateInRing(data.size(), alignment);
+    while (!offset.has_value())
+    {
+        // The ring is full of pending data: send what is recorded and wait for the oldest batch.
+        submit();
+        reclaimStaging(true);
+        offset = allocateInRing(data.size(), alignment);
+    }
+
+    std::memcpy(_ring.data().data() + *offset, data.data(), data.size());
+    _ring.flush(*offset, data.size());
+
+    return {.buffer = _ring, .offset = *offset};
+}
+
+std::optional<VkDeviceSize> UploadService::allocateInRing(VkDeviceSize size, VkDeviceSize alignment)
+{
+    if (_ringTail == _ringHead)
+    {
+        // Nothing staged anymore, restart from the beginning of the ring.
+        _ringHead = (_ringHead + ringSize - 1) / ringSize * ringSize;
+        _ringTail = _ringHead;
+    }
+
+    // Offsets in the ring are aligned, not positions: the ring size may not be a multiple of the alignment.
+    VkDeviceSize const lap = _ringHead / ringSize * ringSize;
+    VkDeviceSize start = lap + (_ringHead - lap + alignment - 1) / alignment * alignment;
+    if (start - lap + size > ringSize)
+    {
+        // Don't wrap a range around the end of the ring, skip to its beginning.
+        start = lap + ringSize;
+    }
+
+    if (start + size - _ringTail > ringSize)
+    {
+        return std::nullopt;
+    }
+
+    _ringHead = start + size;
+
+    return start % ringSize;
+}
+
+bool UploadService::reclaimStaging(bool wait)
+{
+    bool reclaimed = false;
+
+    for (auto &batch : _pending)
+    {
+        if (batch.ringEnd <= _ringTail && batch.stagingBuffers.empty())
+        {
+            continue;
+        }
+
+        if (wait && !reclaimed)
+        {
+            vkWaitForFences(*_device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        }
+        else if (vkGetFenceStatus(*_device, batch.fence) != VK_SUCCESS)
+        {
+            break;
+        }
+
+        _ringTail = std::max(_ringTail, batch.ringEnd);
+        batch.stagingBuffers.clear();
+        reclaimed = true;
+    }
+
+    return reclaimed;
+}
+
+void UploadService::submitIfDue()
+{
+    if (_recording.has_value() && std::chrono::steady_clock::now() - _recording->started >= flushInterval)
+    {
+        submit();
+    }
+}
+
+bool UploadService::transfersOwnership() const
+{
+    return _transferFamily != _graphicsFamily;
+}
@@ -0,0 +1,173 @@
+#ifndef VULKAN_ENGINE_UPLOADSERVICE_H
+#define VULKAN_ENGINE_UPLOADSERVICE_H
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "vulkan.h"
+#include "logicaldevice.h"
+#include "commandpool.h"
+#include "commandbuffer.h"
+#include "buffer.h"
+#include "image.h"
+
+namespace Engine::Vulkan
+{
+/**
+ * Copy host data into device local resources on the transfer queue, without stalling the graphics queue.
+ *
+ * Uploads are recorded into a batch, and `submit()` sends the batch to the transfer queue with a fence. A batch is
+ * also submitted on its own once it holds `flushSize` bytes, or once it is `flushInterval` old at the next
+ * `cmdAcquire()`, so many small uploads share a single command buffer and submit.
+ *
+ * Data is staged in a persistently mapped ring buffer, reused once the batches reading it are complete. Uploads
+ * larger than the ring get a staging buffer of their own. Barriers don't order commands across queues, so once a
+ * batch is complete, `cmdAcquire()` makes its copies visible to the graphics queue, and transitions its images. It is
+ * called once per frame on the frame's command buffer. When the transfer and graphics queue families differ, the
+ * resources are also released by the transfer family, and acquired by the graphics family there.
+ *
+ * A resource may be used by commands recorded after the `cmdAcquire()` that completed its batch, see `isComplete()`.
+ * It must not be destroyed or relocated before that.
+ */
+class UploadService : public OnlyMovable
+{
+public:
+    /**
+     * Identify a submitted batch. Batches complete in submission order.
+     */
+    using Token = uint64;
+
+    [[nodiscard]] static UploadService create(not_null<LogicalDevice*> device);
+
+    ~UploadService();
+    UploadService(UploadService &&) noexcept = default;
+    UploadService &operator=(UploadService &&) noexcept = default;
+
+    /**
+     * Copy `data` at `offset` into `destination`, which needs `VK_BUFFER_USAGE_TRANSFER_DST_BIT`.
+     */
+    void uploadToBuffer(Buffer &destination, std::span<std::byte const> data, VkDeviceSize offset = 0);
+    /**
+     * Copy tightly packed `pixels` into the first mip level of `destination`, which must be in undefined layout and
+     * have `VK_IMAGE_USAGE_TRANSFER_DST_BIT`. It ends in `VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL`.
+     *
+     * The other mip levels, if any, are blitted from the first one by the graphics queue family. The format must
+     * support linear blits, and the image needs `VK_IMAGE_USAGE_TRANSFER_SRC_BIT`.
+     */
+    void uploadToImage(Image &destination, std::span<std::byte const> pixels, VkExtent2D size);
+    /**
+     * Same, with explicit regions whose buffer offsets are relative to `data`. A single region fills the first level
+     * and the others are blitted; otherwise nothing is generated.
+     */
+    void uploadToImage(Image &destination, std::span<std::byte const> data, std::span<VkBufferImageCopy const> regions);
+    /**
+     * Same, from a staging buffer already filled, for instance by a worker thread. The service keeps it alive until
+     * the copy is complete.
+     */
+    void uploadToImage(Image &destination, Buffer &&staging, std::span<VkBufferImageCopy const> regions);
+
+    /**
+     * Submit the uploads recorded since the previous submit.
+     *
+     * @return The token of the batch, or of the previous batch if nothing was recorded.
+     */
+    Token submit();
+    /**
+     * Record the barriers making the uploads of every completed batch visible to a graphics command buffer, with
+     * their ownership acquisitions, layout transitions and mip chain blits, and reclaim their staging memory. Call it
+     * before any command using the uploaded resources.
+     */
+    void cmdAcquire(CommandBuffer &commandBuffer);
+    [[nodiscard]] bool isComplete(Token token) const;
+
+private:
+    static constexpr VkDeviceSize ringSize = 32 * 1024 * 1024;
+    static constexpr VkDeviceSize flushSize = 8 * 1024 * 1024;
+    static constexpr std::chrono::milliseconds flushInterval {8};
+
+    /**
+     * Levels of an image to blit from its first one, after its acquisition.
+     */
+    struct PendingMipChain
+    {
+        VkImage image;
+        VkExtent2D size;
+        uint32 levels;
+    };
+
+    struct Batch
+    {
+        Token token = 0;
+        CommandBuffer commandBuffer;
+        VkFence fence = VK_NULL_HANDLE;
+        std::chrono::steady_clock::time_point started;
+        VkDeviceSize size = 0;
+        // Ring position after the last staging range of this batch.
+        VkDeviceSize ringEnd = 0;
+        // Staging of the uploads too large for the ring.
+        std::vector<Buffer> stagingBuffers;
+
+        // Second halves of the ownership transfers, recorded by `cmdAcquire()`.
+        std::vector<VkBufferMemoryBarrier> bufferAcquires;
+        std::vector<VkImageMemoryBarrier> imageAcquires;
+        std::vector<PendingMipChain> mipChains;
+        // Of the images uploaded, set once acquired.
+        std::vector<std::shared_ptr<VkImageLayout>> imageLayouts;
+    };
+
+    /**
+     * Staging range of an upload, in the ring or in a dedicated buffer.
+     */
+    struct Staging
+    {
+        VkBuffer buffer;
+        VkDeviceSize offset;
+    };
+
+    UploadService(not_null<LogicalDevice*> device, std::unique_ptr<CommandPool> commandPool, Buffer &&ring,
+                  VkDeviceSize ringAlignment);
+
+    not_null<LogicalDevice*> _device;
+    // Command buffers keep a pointer to their pool, which must not move with the service.
+    std::unique_ptr<CommandPool> _commandPool;
+    uint32 _transferFamily;
+    uint32 _graphicsFamily;
+
+    Buffer _ring;
+    // Alignment of every staging range. Copies to images raise it to a multiple of their texel size.
+    VkDeviceSize _ringAlignment;
+    // Positions grow forever, the offset in the ring is the position modulo `ringSize`.
+    // [_ringTail, _ringHead) is still read by submitted batches or written by the recording one.
+    VkDeviceSize _ringHead = 0;
+    VkDeviceSize _ringTail = 0;
+
+    std::optional<Batch> _recording;
+    std::deque<Batch> _pending;
+    Token _lastSubmitted = 0;
+    Token _lastCompleted = 0;
+
+    void recordImageUpload(Image &destination, Staging staging, std::span<VkBufferImageCopy const> regions, VkDeviceSize size);
+    static void cmdBlitMipChain(VkCommandBuffer commandBuffer, PendingMipChain const &mipChain);
+
+    Batch &recording();
+    /**
+     * Copy `data` to staging memory for the recording batch, at an offset multiple of `alignment`. May submit it and
+     * wait for older batches to make room.
+     */
+    Staging stage(std::span<std::byte const> data, VkDeviceSize alignment);
+    std::optional<VkDeviceSize> allocateInRing(VkDeviceSize size, VkDeviceSize alignment);
+    /**
+     * Release the staging memory of the batches the device is done with, blocking for the oldest one if `wait`.
+     * @return Whether some memory was released.
+     */
+    bool reclaimStaging(bool wait);
+    void submitIfDue();
+    [[nodiscard]] bool transfersOwnership() const;
+};
+}
+
+#endif //VULKAN_ENGINE_UPLOADSERVICE_H